@@ -0,0 +1,427 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "InventoryCommandSubsystem.h"
+#include "InventoryComponent.h"
+#include "ItemCatalog.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<float> CVarInventoryCommandBudgetMs(
+	TEXT("SimpleInventory.CommandBudgetMs"),
+	1.0f,
+	TEXT("Milliseconds per frame the inventory command queue is allowed to spend running commands."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarInventoryCommandsPerVisit(
+	TEXT("SimpleInventory.CommandsPerVisit"),
+	32,
+	TEXT("Commands one inventory can run before the queue moves on to the next one, 0 for no limit."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarInventoryCommandMaxPending(
+	TEXT("SimpleInventory.CommandMaxPending"),
+	4096,
+	TEXT("Commands the inventory command queue will hold before turning new ones away."),
+	ECVF_Default);
+
+bool UInventoryCommandSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	if (!Super::ShouldCreateSubsystem(Outer))
+	{
+		return false;
+	}
+
+	UWorld* world = Cast<UWorld>(Outer);
+	return world != nullptr && world->IsGameWorld();
+}
+
+TStatId UInventoryCommandSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UInventoryCommandSubsystem, STATGROUP_Tickables);
+}
+
+void UInventoryCommandSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	if (pendingCount > 0)
+	{
+		runQueues(FMath::Max(CVarInventoryCommandBudgetMs.GetValueOnGameThread(), 0.0f) / 1000.0);
+	}
+	else
+	{
+		stats.executedLastFrame = 0;
+		stats.lastFrameMs = 0;
+	}
+}
+
+void UInventoryCommandSubsystem::flush()
+{
+	if (pendingCount > 0)
+	{
+		runQueues(-1);
+	}
+}
+
+bool UInventoryCommandSubsystem::enqueue(UInventoryComponent* target, FInventoryCommand&& command)
+{
+	if (!IsValid(target))
+	{
+		return false;
+	}
+
+	if (pendingCount >= CVarInventoryCommandMaxPending.GetValueOnGameThread())
+	{
+		++stats.rejectedTotal;
+		return false;
+	}
+
+	command.queuedTime = FPlatformTime::Seconds();
+
+	FComponentQueue* queue = queues.Find(target);
+	if (queue == nullptr)
+	{
+		queue = &queues.Add(target);
+		componentOrder.Add(target);
+	}
+
+	queue->commands.Add(MoveTemp(command));
+	++pendingCount;
+	return true;
+}
+
+bool UInventoryCommandSubsystem::queueAddItem(UInventoryComponent* target, const FInvItem& newItem, const FOnInventoryCommandDone& onDone, bool dropIfNoneAdded, bool dropIfPartialAdded)
+{
+	FInventoryCommand command;
+	command.type = EInventoryCommandType::Add;
+	//A handle the target can't use would also stop this add from coalescing with its neighbours
+	command.item = IsValid(target) ? target->adoptItem(newItem) : newItem;
+	command.dropIfNoneAdded = dropIfNoneAdded;
+	command.dropIfPartialAdded = dropIfPartialAdded;
+	command.onDoneBP = onDone;
+	return enqueue(target, MoveTemp(command));
+}
+
+bool UInventoryCommandSubsystem::queueRemoveItem(UInventoryComponent* target, int slot, const FOnInventoryCommandDone& onDone, bool bShouldDrop)
+{
+	FInventoryCommand command;
+	command.type = EInventoryCommandType::Remove;
+	command.slot = slot;
+	command.shouldDrop = bShouldDrop;
+	command.onDoneBP = onDone;
+	return enqueue(target, MoveTemp(command));
+}
+
+bool UInventoryCommandSubsystem::queueMoveItem(UInventoryComponent* target, int from, int to, const FOnInventoryCommandDone& onDone)
+{
+	FInventoryCommand command;
+	command.type = EInventoryCommandType::Move;
+	command.slot = from;
+	command.otherSlot = to;
+	command.onDoneBP = onDone;
+	return enqueue(target, MoveTemp(command));
+}
+
+bool UInventoryCommandSubsystem::queueSplitStack(UInventoryComponent* target, int slot, int newStackSize, const FOnInventoryCommandDone& onDone)
+{
+	FInventoryCommand command;
+	command.type = EInventoryCommandType::Split;
+	command.slot = slot;
+	command.quantity = newStackSize;
+	command.onDoneBP = onDone;
+	return enqueue(target, MoveTemp(command));
+}
+
+bool UInventoryCommandSubsystem::queueTransfer(UInventoryComponent* target, int slot, UInventoryComponent* newComp, const FOnInventoryCommandDone& onDone)
+{
+	if (!IsValid(newComp))
+	{
+		return false;
+	}
+
+	FInventoryCommand command;
+	command.type = EInventoryCommandType::Transfer;
+	command.slot = slot;
+	command.destination = newComp;
+	command.onDoneBP = onDone;
+	return enqueue(target, MoveTemp(command));
+}
+
+bool UInventoryCommandSubsystem::queueChangeQuantity(UInventoryComponent* target, int uniqueID, int quantityToChange, const FOnInventoryCommandDone& onDone)
+{
+	FInventoryCommand command;
+	command.type = EInventoryCommandType::ChangeQuantity;
+	command.uniqueID = uniqueID;
+	command.quantity = quantityToChange;
+	command.onDoneBP = onDone;
+	return enqueue(target, MoveTemp(command));
+}
+
+FInventoryCommandStats UInventoryCommandSubsystem::getStats()
+{
+	stats.pending = pendingCount;
+	stats.componentsWaiting = componentOrder.Num();
+
+	double now = FPlatformTime::Seconds();
+	double oldest = now;
+	for (const TPair<TWeakObjectPtr<UInventoryComponent>, FComponentQueue>& queue : queues)
+	{
+		if (queue.Value.next < queue.Value.commands.Num())
+		{
+			oldest = FMath::Min(oldest, queue.Value.commands[queue.Value.next].queuedTime);
+		}
+	}
+	stats.oldestPendingMs = static_cast<float>((now - oldest) * 1000.0);
+
+	return stats;
+}
+
+void UInventoryCommandSubsystem::runQueues(double budgetSeconds)
+{
+	double startTime = FPlatformTime::Seconds();
+	bool outOfTime = false;
+	int executed = 0;
+	int perVisit = FMath::Max(CVarInventoryCommandsPerVisit.GetValueOnGameThread(), 0);
+	TArray<TPair<FInventoryCommand, FInventoryCommandResult>> finished;
+
+	while (componentOrder.Num() > 0 && !outOfTime)
+	{
+		if (nextComponent >= componentOrder.Num())
+		{
+			nextComponent = 0;
+		}
+
+		TWeakObjectPtr<UInventoryComponent> key = componentOrder[nextComponent];
+		UInventoryComponent* target = key.Get();
+		FComponentQueue* queue = queues.Find(key);
+
+		//Target went away, fail whatever it still had queued
+		if (queue == nullptr || !IsValid(target))
+		{
+			if (queue != nullptr)
+			{
+				for (int i = queue->next; i < queue->commands.Num(); ++i)
+				{
+					FInventoryCommandResult result;
+					result.type = queue->commands[i].type;
+					finished.Emplace(MoveTemp(queue->commands[i]), result);
+					--pendingCount;
+				}
+			}
+
+			queues.Remove(key);
+			componentOrder.RemoveAt(nextComponent);
+			continue;
+		}
+
+		//Each visit gets a share of the budget and a command cap so one flooded container can't use the whole frame,
+		//not needed when it is the only one waiting
+		bool shareVisit = componentOrder.Num() > 1;
+		double visitStart = FPlatformTime::Seconds();
+		double visitBudget = budgetSeconds >= 0 ? budgetSeconds / componentOrder.Num() : -1;
+		int visitUsed = 0;
+
+		target->beginBatch();
+
+		while (queue != nullptr && queue->next < queue->commands.Num())
+		{
+			int used = executeNext(target, *queue, finished);
+			executed += used;
+			visitUsed += used;
+			pendingCount -= used;
+
+			double now = FPlatformTime::Seconds();
+			if (budgetSeconds >= 0 && now - startTime >= budgetSeconds)
+			{
+				outOfTime = true;
+				break;
+			}
+
+			if (shareVisit && ((perVisit > 0 && visitUsed >= perVisit) || (visitBudget >= 0 && now - visitStart >= visitBudget)))
+			{
+				break;
+			}
+
+			//Anything the commands triggered may have queued more work and moved the map around
+			queue = queues.Find(key);
+		}
+
+		target->endBatch();
+
+		//OnInvChanged handlers run in endBatch and can queue more for this component
+		queue = queues.Find(key);
+		if (queue == nullptr || queue->next >= queue->commands.Num())
+		{
+			queues.Remove(key);
+			componentOrder.RemoveAt(nextComponent);
+		}
+		else
+		{
+			if (queue->next > 64 && queue->next * 2 > queue->commands.Num())
+			{
+				queue->commands.RemoveAt(0, queue->next);
+				queue->next = 0;
+			}
+
+			++nextComponent;
+		}
+	}
+
+	stats.executedLastFrame = executed;
+	stats.executedTotal += executed;
+	stats.lastFrameMs = static_cast<float>((FPlatformTime::Seconds() - startTime) * 1000.0);
+
+	//Callbacks go last so they see every change from this frame and can safely queue more
+	for (TPair<FInventoryCommand, FInventoryCommandResult>& done : finished)
+	{
+		if (done.Key.onDone)
+		{
+			done.Key.onDone(done.Value);
+		}
+
+		done.Key.onDoneBP.ExecuteIfBound(done.Value);
+	}
+}
+
+int UInventoryCommandSubsystem::executeNext(UInventoryComponent* target, FComponentQueue& queue, TArray<TPair<FInventoryCommand, FInventoryCommandResult>>& finished)
+{
+	//Take the commands out before running them since the component can end up queueing more and moving the array
+	TArray<FInventoryCommand> run;
+	run.Add(MoveTemp(queue.commands[queue.next++]));
+
+	UItemAsset* firstItem = run[0].item.item;
+	bool dropIfNoneAdded = run[0].dropIfNoneAdded;
+	bool dropIfPartialAdded = run[0].dropIfPartialAdded;
+
+	//Items with instance data never stack so they always run on their own
+	if (run[0].type == EInventoryCommandType::Add && IsValid(firstItem) && !run[0].item.hasInstanceData())
+	{
+		while (queue.next < queue.commands.Num())
+		{
+			const FInventoryCommand& nextCommand = queue.commands[queue.next];
+
+			if (nextCommand.type != EInventoryCommandType::Add || !IsValid(nextCommand.item.item) || nextCommand.item.hasInstanceData() || nextCommand.item.item->uniqueID != firstItem->uniqueID
+				|| nextCommand.dropIfNoneAdded != dropIfNoneAdded || nextCommand.dropIfPartialAdded != dropIfPartialAdded)
+			{
+				break;
+			}
+
+			run.Add(MoveTemp(queue.commands[queue.next++]));
+		}
+
+		executeAddRun(target, run, finished);
+		return run.Num();
+	}
+
+	FInventoryCommand& command = run[0];
+	FInventoryCommandResult result;
+	result.type = command.type;
+	result.queuedMs = static_cast<float>((FPlatformTime::Seconds() - command.queuedTime) * 1000.0);
+
+	switch (command.type)
+	{
+	case EInventoryCommandType::Add:
+	{
+		FAddItemStatus status = target->addNewItem(command.item, command.dropIfNoneAdded, command.dropIfPartialAdded);
+		result.success = status.addStatus;
+		result.leftOvers = status.leftOvers;
+		break;
+	}
+	case EInventoryCommandType::Remove:
+		result.success = IsValid(target->getItemAtSlot(command.slot).item);
+		target->removeItem(command.slot, command.shouldDrop);
+		break;
+	case EInventoryCommandType::Move:
+		target->moveItem(command.slot, command.otherSlot);
+		result.success = true;
+		break;
+	case EInventoryCommandType::Split:
+		result.success = target->splitStack(command.slot, command.quantity);
+		break;
+	case EInventoryCommandType::Transfer:
+		if (command.destination.IsValid() && command.slot >= 0 && command.slot < target->inventoryArray.Num())
+		{
+			result.success = target->moveToNewInvComp(command.slot, command.destination.Get());
+			result.leftOvers = target->getItemAtSlot(command.slot).quantity;
+		}
+		break;
+	case EInventoryCommandType::ChangeQuantity:
+		result.returnValue = target->changeQuantity(command.uniqueID, command.quantity);
+		result.success = result.returnValue >= 0 && result.returnValue != command.quantity;
+		result.leftOvers = FMath::Max(result.returnValue, 0);
+		break;
+	}
+
+	finished.Emplace(MoveTemp(command), result);
+	return 1;
+}
+
+//Adds of the same item are summed and pushed through addNewItem a stack at a time, then what got in is
+//handed back out to the commands in the order they were queued, so earlier commands fill first
+void UInventoryCommandSubsystem::executeAddRun(UInventoryComponent* target, TArray<FInventoryCommand>& run, TArray<TPair<FInventoryCommand, FInventoryCommandResult>>& finished)
+{
+	double now = FPlatformTime::Seconds();
+
+	if (run.Num() == 1)
+	{
+		FAddItemStatus status = target->addNewItem(run[0].item, run[0].dropIfNoneAdded, run[0].dropIfPartialAdded);
+
+		FInventoryCommandResult result;
+		result.type = EInventoryCommandType::Add;
+		result.success = status.addStatus;
+		result.leftOvers = status.leftOvers;
+		result.queuedMs = static_cast<float>((now - run[0].queuedTime) * 1000.0);
+		finished.Emplace(MoveTemp(run[0]), result);
+		return;
+	}
+
+	stats.coalescedTotal += run.Num() - 1;
+
+	int total = 0;
+	for (const FInventoryCommand& command : run)
+	{
+		total += FMath::Max(command.item.quantity, 0);
+	}
+
+	int maxStackSize = FMath::Max(FItemCatalog::getMaxStackSize(run[0].item.item), 1);
+	int remaining = total;
+
+	while (remaining > 0)
+	{
+		FInvItem chunk = run[0].item;
+		chunk.quantity = FMath::Min(remaining, maxStackSize);
+
+		FAddItemStatus status = target->addNewItem(chunk, false, false);
+		int added = status.addStatus ? chunk.quantity - status.leftOvers : 0;
+		remaining -= added;
+
+		if (added < chunk.quantity)
+		{
+			break;
+		}
+	}
+
+	int addedLeft = total - remaining;
+
+	for (FInventoryCommand& command : run)
+	{
+		int wanted = FMath::Max(command.item.quantity, 0);
+		int added = FMath::Min(wanted, addedLeft);
+		addedLeft -= added;
+
+		FInventoryCommandResult result;
+		result.type = EInventoryCommandType::Add;
+		result.success = added > 0;
+		result.leftOvers = wanted - added;
+		result.queuedMs = static_cast<float>((now - command.queuedTime) * 1000.0);
+
+		if (result.leftOvers > 0 && (added == 0 ? command.dropIfNoneAdded : command.dropIfPartialAdded))
+		{
+			FInvItem itemToDrop = command.item;
+			itemToDrop.quantity = result.leftOvers;
+			target->createLootBag(itemToDrop);
+		}
+
+		finished.Emplace(MoveTemp(command), result);
+	}
+}
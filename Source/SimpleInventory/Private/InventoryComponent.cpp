@@ -2,8 +2,14 @@
 
 
 #include "InventoryComponent.h"
+#include "LootBagSubsystem.h"
+#include "InventoryJournalSubsystem.h"
+#include "InventoryTrace.h"
+#include "ItemCatalog.h"
 #include "Kismet/KismetMathLibrary.h" 
 
+DEFINE_LOG_CATEGORY_STATIC(LogInventory, Log, All);
+
 // Sets default values for this component's properties
 UInventoryComponent::UInventoryComponent()
 {
@@ -11,6 +17,7 @@ UInventoryComponent::UInventoryComponent()
 	// off to improve performance if you don't need them.
 	PrimaryComponentTick.bCanEverTick = false;
 	inventoryArray = TArray<FInvItem>();
+	snapshotPublisher = MakeShared<FInventorySnapshotPublisher, ESPMode::ThreadSafe>();
 
 	/*Put a reference to a backup upgrade item here
 	if (upgradeItem == nullptr)
@@ -30,12 +37,88 @@ UInventoryComponent::UInventoryComponent()
 void UInventoryComponent::BeginPlay()
 {
 	Super::BeginPlay();
+
+	//Replay builds its inventories from their recorded setup, so the setup itself stays out of the trace
+	FInventoryTraceSuspend suspendTrace;
+
+	if (useShapedItems)
+	{
+		slotsPerRow = FMath::Min(slotsPerRow, FInventoryGrid::maxColumns);
+		grid.reset(slotsPerRow, 0);
+	}
+
 	addNewRows(inventoryRows, true);
+
+	if (journalChanges)
+	{
+		startJournal();
+	}
+}
+
+void UInventoryComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	//Destroyed inventories are gone for good, anything else (quitting, streaming out, travel) should come back next time
+	if (journal != nullptr && EndPlayReason == EEndPlayReason::Destroyed)
+	{
+		journal->recordRemove(journalKey);
+	}
+
+	journal = nullptr;
+
+	Super::EndPlay(EndPlayReason);
+}
+
+//Picks the key and restores from it, without a journalId only inventories on actors placed in the level have a key that lasts between sessions
+void UInventoryComponent::startJournal()
+{
+	//Replicated copies on clients would restore over what the server sends them
+	UInventoryJournalSubsystem* worldJournal = GetWorld()->GetSubsystem<UInventoryJournalSubsystem>();
+	if (worldJournal == nullptr || GetOwner() == nullptr || !GetOwner()->HasAuthority())
+	{
+		return;
+	}
+
+	if (journalId.IsNone())
+	{
+		//Spawned actors get names like BP_LootBag_C_0 again next session, which would hand them someone else's items
+		AActor* owner = GetOwner();
+		if (owner == nullptr || !owner->IsNetStartupActor() || CreationMethod == EComponentCreationMethod::Instance)
+		{
+			UE_LOG(LogInventory, Warning, TEXT("%s is not journaled, inventories on spawned actors need a journalId"), *GetPathName());
+			return;
+		}
+
+		journalKey = UWorld::RemovePIEPrefix(GetPathName());
+	}
+	else
+	{
+		journalKey = journalId.ToString();
+	}
+
+	journal = worldJournal;
+	restoreFromJournal();
+}
+
+void UInventoryComponent::setJournalId(FName newJournalId)
+{
+	if (journal != nullptr)
+	{
+		return;
+	}
+
+	journalId = newJournalId;
+
+	if (journalChanges && HasBegunPlay())
+	{
+		startJournal();
+	}
 }
 
 //Adds another row of empty slots to the inventory
 bool UInventoryComponent::addNewRows(int numRows, bool ignoreUpgradeItem)
 {
+	FInventoryTraceScope trace(this, EInventoryTraceOp::AddNewRows, { numRows, ignoreUpgradeItem ? 1 : 0 });
+
 	if (inventoryArray.Num() / slotsPerRow == maxInventoryRows)
 	{
 		return false;
@@ -54,6 +137,8 @@ bool UInventoryComponent::addNewRows(int numRows, bool ignoreUpgradeItem)
 		}
 	}
 
+	int oldRows = getRows();
+
 	for (int i = 0; i < (numRows * slotsPerRow); ++i)
 	{
 		if (inventoryArray.Num() / slotsPerRow == maxInventoryRows)
@@ -65,6 +150,17 @@ bool UInventoryComponent::addNewRows(int numRows, bool ignoreUpgradeItem)
 		newEmptyItem.quantity = 0;
 		newEmptyItem.item = nullptr;
 		inventoryArray.Add(newEmptyItem);
+		applySlotToTotals(newEmptyItem, 1);
+	}
+
+	if (useShapedItems)
+	{
+		grid.addRows(getRows() - oldRows);
+	}
+
+	if (journal != nullptr)
+	{
+		journal->recordResize(journalKey, inventoryArray.Num());
 	}
 
 	for (int i = 0; i < numRows; ++i)
@@ -72,14 +168,18 @@ bool UInventoryComponent::addNewRows(int numRows, bool ignoreUpgradeItem)
 		OnRowsAddedd.Broadcast();
 	}
 	
-	OnInvChanged.Broadcast();
+	broadcastInvChanged();
 
 	return true;
 }
 
 //Adds to new slot if there is none in the inventory already, otherwise adds to stack
-FAddItemStatus UInventoryComponent::addNewItem(const FInvItem& newItem, bool dropIfFull, bool dropIfPartialAdded)
+FAddItemStatus UInventoryComponent::addNewItem(const FInvItem& incomingItem, bool dropIfFull, bool dropIfPartialAdded)
 {
+	FInventoryTraceScope trace(this, EInventoryTraceOp::AddNewItem, { dropIfFull ? 1 : 0, dropIfPartialAdded ? 1 : 0 }, MakeArrayView(&incomingItem, 1));
+
+	const FInvItem newItem = adoptItem(incomingItem);
+
 	UItemAsset* itemAsset = newItem.item;
 	FAddItemStatus statusReturn;
 
@@ -97,30 +197,41 @@ FAddItemStatus UInventoryComponent::addNewItem(const FInvItem& newItem, bool dro
 		statusReturn.leftOvers = 0;
 		return statusReturn;
 	}
-	else if (quant == 0 || quant % newItem.item->maxStackSize == 0)
+	else if ((newItem.hasInstanceData() ? getNewStackCapacity(itemAsset) : getRemainingCapacity(itemAsset)) == 0)
+	{
+		//No partial stacks and no empty slots so nothing can go in, skip the scans
+		statusReturn.addStatus = false;
+		statusReturn.leftOvers = newItem.quantity;
+
+		if (dropIfFull)
+		{
+			createLootBag(newItem);
+		}
+
+		return statusReturn;
+	}
+	else if (quant == 0 || itemTotals[itemAsset->uniqueID].freeSpace == 0 || newItem.hasInstanceData())
 	{
 		//Put it in the first empty position
-		for (int i = 0; i < inventoryArray.Num(); ++i)
+		bool rotated = false;
+		int emptySlot = findEmptySlotFor(itemAsset, rotated);
+
+		if (emptySlot != -1)
 		{
-			UItemAsset* curItem = inventoryArray[i].item;
-			if (curItem == nullptr)
-			{
-				inventoryArray[i] = newItem;
-				OnInvChanged.Broadcast();
-				statusReturn.addStatus = true;
-				statusReturn.leftOvers = 0;
-				return statusReturn;
-			}
-			else if (i == inventoryArray.Num() - 1)
-			{
-				//No room in inventory so create a lootbag if it was request thend return as failed
-				statusReturn.addStatus = false;
+			setSlot(emptySlot, newItem, rotated);
+			broadcastInvChanged();
+			statusReturn.addStatus = true;
+			statusReturn.leftOvers = 0;
+			return statusReturn;
+		}
 
-				if (dropIfFull)
-				{
-					createLootBag(newItem);
-				}
-			}
+		//No room in inventory so create a lootbag if it was request thend return as failed
+		statusReturn.addStatus = false;
+		statusReturn.leftOvers = newItem.quantity;
+
+		if (dropIfFull)
+		{
+			createLootBag(newItem);
 		}
 
 		return statusReturn;
@@ -159,19 +270,36 @@ FAddItemStatus UInventoryComponent::addNewItem(const FInvItem& newItem, bool dro
 }
 
 //Assume its only called for empty slots, currently only used from drag and drop UI
-void UInventoryComponent::addItemAtSlot(const FInvItem& newItem, int slot)
+void UInventoryComponent::addItemAtSlot(const FInvItem& incomingItem, int slot)
 {
+	FInventoryTraceScope trace(this, EInventoryTraceOp::AddItemAtSlot, { slot }, MakeArrayView(&incomingItem, 1));
+
 	if (slot < inventoryArray.Num())
 	{
-		inventoryArray[slot] = newItem;
-		OnInvChanged.Broadcast();
+		const FInvItem newItem = adoptItem(incomingItem);
+		bool rotated = false;
+
+		if (useShapedItems && !canPlaceItemAt(newItem.item, slot))
+		{
+			//Try it turned sideways before giving up
+			rotated = true;
+			if (!allowRotation || !canPlaceItemAt(newItem.item, slot, rotated))
+			{
+				return;
+			}
+		}
+
+		setSlot(slot, newItem, rotated);
+		broadcastInvChanged();
 	}
 }
 
 
 void UInventoryComponent::moveItem(int from, int to)
 {
-	if ((from < 0 || from >= inventoryArray.Num()) || (to < 0 || to > inventoryArray.Num()))
+	FInventoryTraceScope trace(this, EInventoryTraceOp::MoveItem, { from, to });
+
+	if ((from < 0 || from >= inventoryArray.Num()) || (to < 0 || to >= inventoryArray.Num()) || from == to)
 	{
 		return;
 	}
@@ -180,39 +308,62 @@ void UInventoryComponent::moveItem(int from, int to)
 	UItemAsset* prevItemAsset = prevItem.item;
 
 	UItemAsset* toItemAsset = inventoryArray[from].item;
+	bool sameItem = prevItem == inventoryArray[from];
+
+	//Shaped items can only go into free space or onto a matching stack, different sizes can't be swapped
+	if (useShapedItems && !sameItem)
+	{
+		moveShapedItem(from, to);
+		return;
+	}
 
-	//If items are the same item combine stacks if possible
+	//If items are the same item combine stacks if possible, swapping leaves the totals untouched
 	if (prevItemAsset == nullptr)
 	{
-		inventoryArray[to] = inventoryArray[from];
-		inventoryArray[from] = prevItem;
+		inventoryArray.Swap(from, to);
+		snapshotDirty = true;
+
+		if (journal != nullptr)
+		{
+			journalSlot(from);
+			journalSlot(to);
+		}
 	}
-	else if (IsValid(prevItemAsset) && prevItemAsset->uniqueID == toItemAsset->uniqueID)
+	else if (sameItem)
 	{
 		//If combined they are a full stack or less combine into one stack, otherwise move a quantity
-		if (prevItem.quantity + inventoryArray[from].quantity <= prevItemAsset->maxStackSize)
+		int maxStackSize = FItemCatalog::getMaxStackSize(prevItemAsset);
+		if (prevItem.quantity + inventoryArray[from].quantity <= maxStackSize)
 		{
-			inventoryArray[to].quantity += inventoryArray[from].quantity;
+			setSlotQuantity(to, prevItem.quantity + inventoryArray[from].quantity);
 			removeItem(from, false);
 		}
 		else
 		{
-			int amountToLeave = (prevItem.quantity + inventoryArray[from].quantity ) - prevItemAsset->maxStackSize;
-			inventoryArray[to].quantity = prevItemAsset->maxStackSize;
-			inventoryArray[from].quantity = amountToLeave;
+			int amountToLeave = (prevItem.quantity + inventoryArray[from].quantity ) - maxStackSize;
+			setSlotQuantity(to, maxStackSize);
+			setSlotQuantity(from, amountToLeave);
 		}
 	}
 	else
 	{
-		inventoryArray[to] = inventoryArray[from];
-		inventoryArray[from] = prevItem;
+		inventoryArray.Swap(from, to);
+		snapshotDirty = true;
+
+		if (journal != nullptr)
+		{
+			journalSlot(from);
+			journalSlot(to);
+		}
 	}
 
-	OnInvChanged.Broadcast();
+	broadcastInvChanged();
 }
 
 void UInventoryComponent::removeItem(int slot, bool bShouldDrop)
 {
+	FInventoryTraceScope trace(this, EInventoryTraceOp::RemoveItem, { slot, bShouldDrop ? 1 : 0 });
+
 	if (slot < 0 || slot >= inventoryArray.Num())
 	{
 		return;
@@ -227,34 +378,74 @@ void UInventoryComponent::removeItem(int slot, bool bShouldDrop)
 		createLootBag(inventoryArray[slot]);
 	}
 
-	inventoryArray[slot] = newEmptyItem;
-	OnInvChanged.Broadcast();
+	//If the drop carried the instance data into a loot bag the handle is already stale and this does nothing
+	instancePool.release(inventoryArray[slot].instanceHandle);
+	setSlot(slot, newEmptyItem);
+	broadcastInvChanged();
 }
 
+//-1 gives the amount of empty slots
 int UInventoryComponent::getItemQuantity(int uniqueID)
 {
-	int curAmt = 0;
-	for(int i = 0; i < inventoryArray.Num(); ++i)
+	FInventoryTraceScope trace(this, EInventoryTraceOp::GetItemQuantity, { uniqueID });
+
+	if (uniqueID == -1)
 	{
-		UItemAsset* curItemAsset = inventoryArray[i].item;
+		return getAmountOfEmptySlots();
+	}
 
-		if (IsValid(curItemAsset))
-		{
-			if (curItemAsset->uniqueID == uniqueID)
-			{
-				curAmt += inventoryArray[i].quantity;
-			}
-		}
-		else if (uniqueID == -1)
-		{
-			curAmt += 1;
-		}
+	const FInvItemTotals* itemTotal = itemTotals.Find(uniqueID);
+	return itemTotal ? itemTotal->quantity : 0;
+}
+
+int UInventoryComponent::getTypeQuantity(const FName type)
+{
+	const FInvItemTotals* typeTotal = typeTotals.Find(type);
+	return typeTotal ? typeTotal->quantity : 0;
+}
+
+//Room left in partial stacks of this item plus a full stack for every empty slot
+int UInventoryComponent::getRemainingCapacity(UItemAsset* itemAsset)
+{
+	FInvItem traceItem;
+	traceItem.item = itemAsset;
+	FInventoryTraceScope trace(this, EInventoryTraceOp::GetRemainingCapacity, {}, MakeArrayView(&traceItem, 1));
+
+	if (!IsValid(itemAsset))
+	{
+		return 0;
 	}
-	return curAmt;
+
+	const FInvItemTotals* itemTotal = itemTotals.Find(itemAsset->uniqueID);
+	int partialSpace = itemTotal ? itemTotal->freeSpace : 0;
+
+	return partialSpace + getNewStackCapacity(itemAsset);
+}
+
+//Just the empty slot part of getRemainingCapacity, items with instance data can only go here
+int UInventoryComponent::getNewStackCapacity(UItemAsset* itemAsset)
+{
+	if (!IsValid(itemAsset))
+	{
+		return 0;
+	}
+
+	int maxStackSize = FItemCatalog::getMaxStackSize(itemAsset);
+
+	//Free cells don't map to whole stacks when items have shapes, so only count whether one more stack fits
+	if (useShapedItems)
+	{
+		bool rotated = false;
+		return findEmptySlotFor(itemAsset, rotated) != -1 ? maxStackSize : 0;
+	}
+
+	return emptySlots * maxStackSize;
 }
 
 FInvItem UInventoryComponent::getItemAtSlot(int slot)
 {
+	FInventoryTraceScope trace(this, EInventoryTraceOp::GetItemAtSlot, { slot });
+
 	if(slot >= inventoryArray.Num() || slot < 0)
 		return FInvItem();
 	else
@@ -315,14 +506,7 @@ int UInventoryComponent::findNextItemOfType(int startPos, int direction, const F
 //Simple check to see if ANY of the item type is in the inventory
 bool UInventoryComponent::itemTypeExists(const FName typeToSearchFor)
 {
-	for (int i = 0; i < inventoryArray.Num(); ++i)
-	{
-		UItemAsset* curItem = inventoryArray[i].item;
-
-		if(curItem->type == typeToSearchFor)
-			return true;
-	}
-	return false;
+	return typeTotals.Contains(typeToSearchFor);
 }
 
 UItemAsset* UInventoryComponent::findItemAssetByID(int uniqueID)
@@ -346,9 +530,15 @@ UItemAsset* UInventoryComponent::findItemAssetByID(int uniqueID)
 //Return -2 means you tried to change more than max stack at one time
 int UInventoryComponent::changeQuantity(int uniqueID, int quantityToChange)
 {
+	FInventoryTraceScope trace(this, EInventoryTraceOp::ChangeQuantity, { uniqueID, quantityToChange });
+
 	UItemAsset* itemToChange = findItemAssetByID(uniqueID);
 
-	if(!IsValid(itemToChange) || FMath::Abs(quantityToChange) > itemToChange->maxStackSize)
+	if(!IsValid(itemToChange))
+		return -2;
+
+	int maxStackSize = FItemCatalog::getMaxStackSize(itemToChange);
+	if(FMath::Abs(quantityToChange) > maxStackSize)
 		return -2;
 	
 	//Checks for existing stacks to edit first
@@ -358,40 +548,41 @@ int UInventoryComponent::changeQuantity(int uniqueID, int quantityToChange)
 	{
 		UItemAsset* curItem = inventoryArray[i].item;
 
-		if (IsValid(curItem) && curItem->uniqueID == uniqueID)
+		//Items with instance data are left alone, they don't stack and shouldn't be used up as plain quantity
+		if (IsValid(curItem) && curItem->uniqueID == uniqueID && !inventoryArray[i].hasInstanceData())
 		{
 			int curAmt = inventoryArray[i].quantity;
 
 			if (curAmt + amountLeftToChange == 0)
 			{
 				removeItem(i, false);
-				OnInvChanged.Broadcast();
+				broadcastInvChanged();
 				return 0;
 			}
 			else if (curAmt + amountLeftToChange <= 0)
 			{
 				amountLeftToChange = amountLeftToChange - inventoryArray[i].quantity;
 				removeItem(i, false);
-				OnInvChanged.Broadcast();
+				broadcastInvChanged();
 				i = 0;
 				return 0;
 			}
-			else if(UKismetMathLibrary::SignOfInteger(amountLeftToChange) > 0 && curAmt + amountLeftToChange > itemToChange->maxStackSize && curAmt != itemToChange->maxStackSize)
+			else if(UKismetMathLibrary::SignOfInteger(amountLeftToChange) > 0 && curAmt + amountLeftToChange > maxStackSize && curAmt != maxStackSize)
 			{
-				amountLeftToChange = amountLeftToChange - (itemToChange->maxStackSize - inventoryArray[i].quantity);
-				inventoryArray[i].quantity = itemToChange->maxStackSize;
-				OnInvChanged.Broadcast();
+				amountLeftToChange = amountLeftToChange - (maxStackSize - inventoryArray[i].quantity);
+				setSlotQuantity(i, maxStackSize);
+				broadcastInvChanged();
 			}
 			else if (UKismetMathLibrary::SignOfInteger(amountLeftToChange) < 0)
 			{
-				inventoryArray[i].quantity += amountLeftToChange;
-				OnInvChanged.Broadcast();
+				setSlotQuantity(i, curAmt + amountLeftToChange);
+				broadcastInvChanged();
 				return 0;
 			}
-			else if(inventoryArray[i].quantity != itemToChange->maxStackSize)
+			else if(inventoryArray[i].quantity != maxStackSize)
 			{
-				inventoryArray[i].quantity += amountLeftToChange;
-				OnInvChanged.Broadcast();
+				setSlotQuantity(i, curAmt + amountLeftToChange);
+				broadcastInvChanged();
 				return 0;
 			}
 		}
@@ -400,38 +591,20 @@ int UInventoryComponent::changeQuantity(int uniqueID, int quantityToChange)
 	//Leftovers remain after adding to existing stacks
 	if (amountLeftToChange > 0)
 	{
-		FInvItem tempCopy = FInvItem();
-		int emptySlot = -1;
-
-		for(int i = 0; i < inventoryArray.Num(); ++i)
-		{
-			UItemAsset* curItem = inventoryArray[i].item;
-
-			if (curItem == nullptr && emptySlot == -1)
-			{
-				emptySlot = i;
-			}
-			else if (IsValid(curItem) && curItem->uniqueID == uniqueID)
-			{
-				tempCopy = inventoryArray[i];
-			}
-		}
-
-		UItemAsset* tempItem = tempCopy.item;
+		bool rotated = false;
+		int emptySlot = findEmptySlotFor(itemToChange, rotated);
 
 		if (emptySlot == -1)
 		{
 			return amountLeftToChange;
 		}
-		else if (tempItem == nullptr)
-		{
-			return amountLeftToChange;
-		}
 		else
 		{
-			inventoryArray[emptySlot] = tempCopy;
-			inventoryArray[emptySlot].quantity = amountLeftToChange;
-			OnInvChanged.Broadcast();
+			FInvItem tempCopy = FInvItem();
+			tempCopy.item = itemToChange;
+			tempCopy.quantity = amountLeftToChange;
+			setSlot(emptySlot, tempCopy, rotated);
+			broadcastInvChanged();
 			return 0;
 		}
 	}
@@ -442,22 +615,23 @@ int UInventoryComponent::changeQuantity(int uniqueID, int quantityToChange)
 //Split position into two stacks
 bool UInventoryComponent::splitStack(int slot, int newStackSize)
 {
-	if(slot < 0 || slot >= inventoryArray.Num() || newStackSize >= inventoryArray[slot].quantity)
+	FInventoryTraceScope trace(this, EInventoryTraceOp::SplitStack, { slot, newStackSize });
+
+	if(slot < 0 || slot >= inventoryArray.Num() || newStackSize >= inventoryArray[slot].quantity || inventoryArray[slot].hasInstanceData())
 		return false;
 
 	//Find empty spot then split or display error if no slots
-	for (int i = 0; i < inventoryArray.Num(); ++i)
-	{
-		UItemAsset* curItem = inventoryArray[i].item;
+	bool rotated = false;
+	int emptySlot = findEmptySlotFor(inventoryArray[slot].item, rotated);
 
-		if (curItem == nullptr)
-		{
-			inventoryArray[i] = inventoryArray[slot];
-			inventoryArray[i].quantity = newStackSize;
-			inventoryArray[slot].quantity = inventoryArray[slot].quantity - newStackSize;
-			OnInvChanged.Broadcast();
-			return true;
-		}
+	if (emptySlot != -1)
+	{
+		FInvItem newStack = inventoryArray[slot];
+		newStack.quantity = newStackSize;
+		setSlot(emptySlot, newStack, rotated);
+		setSlotQuantity(slot, inventoryArray[slot].quantity - newStackSize);
+		broadcastInvChanged();
+		return true;
 	}
 
 	//Display inventory full error
@@ -468,30 +642,88 @@ bool UInventoryComponent::splitStack(int slot, int newStackSize)
 //Move from one inventory to another for usage with chests
 bool UInventoryComponent::moveToNewInvComp(int slot, UInventoryComponent* newComp)
 {
+	FInventoryTraceScope trace(this, EInventoryTraceOp::MoveToNewInvComp, { slot }, {}, newComp);
+
 	//Check if any stacks already exist and add to them if possible
-	FAddItemStatus addStatus = newComp->addNewItem(inventoryArray[slot], false, false);
+	FAddItemStatus addStatus = giveItemTo(inventoryArray[slot], newComp, false, false);
 	if (!addStatus.addStatus)
 	{
 		return false;
 	}
 	else if(addStatus.leftOvers > 0)
 	{
-		inventoryArray[slot].quantity = addStatus.leftOvers;
-		OnInvChanged.Broadcast();
+		setSlotQuantity(slot, addStatus.leftOvers);
+		broadcastInvChanged();
 		return true;
 	}
 	else
 	{
 		removeItem(slot, false);
-		OnInvChanged.Broadcast();
+		broadcastInvChanged();
 		return true;
 	}
 }
 
+//addNewItem on another inventory, moving the instance data into its pool when the item has any
+FAddItemStatus UInventoryComponent::giveItemTo(const FInvItem& item, UInventoryComponent* newComp, bool dropIfNoneAdded, bool dropIfPartialAdded)
+{
+	if (!item.hasInstanceData() || newComp == this)
+	{
+		return newComp->addNewItem(item, dropIfNoneAdded, dropIfPartialAdded);
+	}
+
+	//Instanced items need a slot of their own, check first so the data only moves if the add will work
+	if (newComp->getNewStackCapacity(item.item) == 0)
+	{
+		FAddItemStatus statusReturn;
+		statusReturn.addStatus = false;
+		statusReturn.leftOvers = item.quantity;
+		return statusReturn;
+	}
+
+	FInvItem movedItem = item;
+	FItemInstanceData movedData;
+	if (instancePool.take(item.instanceHandle, movedData))
+	{
+		movedItem.instanceHandle = newComp->instancePool.allocate(MoveTemp(movedData));
+	}
+
+	return newComp->addNewItem(movedItem, false, false);
+}
+
+//Bulk version of moveToNewInvComp, both inventories only broadcast once at the end
+bool UInventoryComponent::moveAllToNewInvComp(UInventoryComponent* newComp)
+{
+	FInventoryTraceScope trace(this, EInventoryTraceOp::MoveAllToNewInvComp, {}, {}, newComp);
+
+	if (!IsValid(newComp) || newComp == this)
+	{
+		return isEmpty();
+	}
+
+	beginBatch();
+	newComp->beginBatch();
+
+	for (int i = 0; i < inventoryArray.Num(); ++i)
+	{
+		if (IsValid(inventoryArray[i].item))
+		{
+			moveToNewInvComp(i, newComp);
+		}
+	}
+
+	newComp->endBatch();
+	endBatch();
+
+	return isEmpty();
+}
+
 
 //Function to allow the user to drop items on the ground or for say plants to request a loot bag dropped if the new amount would overflow
 void UInventoryComponent::createLootBag(const FInvItem& itemToDrop, int slot)
 {
+	FInventoryTraceScope trace(this, EInventoryTraceOp::CreateLootBag, { slot }, MakeArrayView(&itemToDrop, 1));
+
 	if(!IsValid(lootBag))
 		return;
 
@@ -501,20 +733,20 @@ void UInventoryComponent::createLootBag(const FInvItem& itemToDrop, int slot)
 	//if leftovers try to add to other lootbags nearby
 	//or if no other lootbag make a new one
 	FInvItem item = itemToDrop;
+	ULootBagSubsystem* bagSubsystem = GetWorld()->GetSubsystem<ULootBagSubsystem>();
 
 	TArray<AActor*> lootBags;
 	UGameplayStatics::GetAllActorsOfClass(GetWorld(), lootBag, lootBags);
 
 	if (lootBags.Num() > 0)
 	{
-		for (int i = 0; i < lootBags.Num(); ++i)
+		//Pooled bags are hidden and waiting for reuse so they don't count as nearby
+		FVector ownerLoc = GetOwner()->GetActorLocation();
+		float maxDist = mergeDist;
+		lootBags.RemoveAll([bagSubsystem, &ownerLoc, maxDist](const AActor* curBag)
 		{
-			if (FVector::Distance(GetOwner()->GetActorLocation(), lootBags[i]->GetActorLocation()) > mergeDist)
-			{
-				lootBags.RemoveAt(i);
-				i = 0;
-			}
-		}
+			return FVector::Distance(ownerLoc, curBag->GetActorLocation()) > maxDist || (bagSubsystem != nullptr && bagSubsystem->isPooled(curBag));
+		});
 
 		if (lootBags.Num() > 0)
 		{
@@ -524,7 +756,7 @@ void UInventoryComponent::createLootBag(const FInvItem& itemToDrop, int slot)
 
 				if (IsValid(curInv))
 				{
-					FAddItemStatus newStatus = curInv->addNewItem(item, false, false);
+					FAddItemStatus newStatus = giveItemTo(item, curInv, false, false);
 
 					if (newStatus.leftOvers == 0)
 					{
@@ -542,13 +774,19 @@ void UInventoryComponent::createLootBag(const FInvItem& itemToDrop, int slot)
 
 
 	FVector spawnLoc = GetOwner()->GetActorLocation() + ( GetOwner()->GetActorForwardVector() * 200);
-	AActor* newLootBag = GetWorld()->SpawnActor<AActor>(lootBag, spawnLoc, GetOwner()->GetActorRotation());
+	AActor* newLootBag = bagSubsystem != nullptr ? bagSubsystem->spawnLootBag(lootBag, spawnLoc, GetOwner()->GetActorRotation())
+		: GetWorld()->SpawnActor<AActor>(lootBag, spawnLoc, GetOwner()->GetActorRotation());
+
+	if (!IsValid(newLootBag))
+	{
+		return;
+	}
 
 	UInventoryComponent* newInvComp = Cast<UInventoryComponent>(newLootBag->GetComponentByClass(UInventoryComponent::StaticClass()));
 
 	if (IsValid(newInvComp))
 	{
-		FAddItemStatus tryDrop = Cast<UInventoryComponent>(newInvComp)->addNewItem(item);
+		FAddItemStatus tryDrop = giveItemTo(item, newInvComp, false, true);
 
 		if (tryDrop.addStatus && slot >= 0 && slot < inventoryArray.Num())
 		{
@@ -556,7 +794,14 @@ void UInventoryComponent::createLootBag(const FInvItem& itemToDrop, int slot)
 		}
 		else if (!tryDrop.addStatus)
 		{
-			newLootBag->Destroy();
+			if (bagSubsystem != nullptr)
+			{
+				bagSubsystem->releaseLootBag(newLootBag);
+			}
+			else
+			{
+				newLootBag->Destroy();
+			}
 		}
 	}
 }
@@ -565,31 +810,568 @@ void UInventoryComponent::createLootBag(const FInvItem& itemToDrop, int slot)
 
 bool UInventoryComponent::isEmpty()
 {
-	for (int i = 0; i < inventoryArray.Num(); ++i)
+	return itemTotals.Num() == 0;
+}
+
+int UInventoryComponent::getRows()
+{
+	return inventoryArray.Num() / slotsPerRow;
+}
+
+FInventorySaveData UInventoryComponent::saveInventory()
+{
+	FInventorySaveData saveData;
+	saveData.items = inventoryArray;
+
+	for (int i = 0; i < saveData.items.Num(); ++i)
 	{
-		UItemAsset* curItem = inventoryArray[i].item;
+		FInvItem& savedItem = saveData.items[i];
+		if (const FItemInstanceData* instanceData = instancePool.find(savedItem.instanceHandle))
+		{
+			saveData.instanceData.Add(*instanceData);
+			saveData.instanceSlots.Add(i);
+		}
+		savedItem.instanceHandle = 0;
+	}
 
-		if(curItem != nullptr)
-			return false;
+	return saveData;
+}
+
+void UInventoryComponent::loadSavedInventory(FInventorySaveData saveData)
+{
+	//Replays as a plain loadInventory, instance data isn't part of the trace
+	FInventoryTraceScope trace(this, EInventoryTraceOp::LoadInventory, {}, saveData.items);
+
+	//Handles in a save mean nothing now, loadInventory frees the data of the slots it actually replaces
+	for (FInvItem& savedItem : saveData.items)
+	{
+		savedItem.instanceHandle = 0;
+	}
+
+	for (int i = 0; i < saveData.instanceSlots.Num() && i < saveData.instanceData.Num(); ++i)
+	{
+		int slot = saveData.instanceSlots[i];
+		if (saveData.items.IsValidIndex(slot) && IsValid(saveData.items[slot].item) && !saveData.items[slot].hasInstanceData())
+		{
+			saveData.items[slot].instanceHandle = instancePool.allocate(MoveTemp(saveData.instanceData[i]));
+		}
+	}
+
+	loadInventory(MoveTemp(saveData.items));
+}
+
+bool UInventoryComponent::getInstanceData(int slot, FItemInstanceData& outData)
+{
+	const FItemInstanceData* instanceData = findInstanceData(slot);
+
+	if (instanceData == nullptr)
+	{
+		return false;
 	}
 
+	outData = *instanceData;
 	return true;
 }
 
-int UInventoryComponent::getRows()
+bool UInventoryComponent::setInstanceData(int slot, const FItemInstanceData& newData)
 {
-	return inventoryArray.Num() / slotsPerRow;
+	if (slot < 0 || slot >= inventoryArray.Num() || !IsValid(inventoryArray[slot].item))
+	{
+		return false;
+	}
+
+	if (FItemInstanceData* instanceData = findInstanceData(slot))
+	{
+		*instanceData = newData;
+
+		if (journal != nullptr)
+		{
+			journalSlot(slot);
+		}
+
+		broadcastInvChanged();
+		return true;
+	}
+
+	//First time this slot gets data, it stops stacking from here on
+	FInvItem updatedItem = inventoryArray[slot];
+	updatedItem.instanceHandle = instancePool.allocate(FItemInstanceData(newData));
+	if (!updatedItem.hasInstanceData())
+	{
+		return false;
+	}
+
+	setSlot(slot, updatedItem);
+	broadcastInvChanged();
+	return true;
+}
+
+FItemInstanceData* UInventoryComponent::findInstanceData(int slot)
+{
+	if (slot < 0 || slot >= inventoryArray.Num())
+	{
+		return nullptr;
+	}
+
+	return instancePool.find(inventoryArray[slot].instanceHandle);
 }
 
 void UInventoryComponent::loadInventory(TArray<FInvItem> newInv)
 {
+	FInventoryTraceScope trace(this, EInventoryTraceOp::LoadInventory, {}, newInv);
+
 	if (newInv.Num() > 0)
+	{
+		//Own handles can come back in (loadSavedInventory, or the same array from getInventory) but each one only once
+		TSet<int32> keptHandles;
+		for (int i = 0; i < inventoryArray.Num() && i < newInv.Num(); ++i)
+		{
+			FInvItem& newItem = newInv[i];
+			if (newItem.hasInstanceData())
+			{
+				bool alreadyKept = false;
+				keptHandles.Add(newItem.instanceHandle, &alreadyKept);
+				if (alreadyKept || !instancePool.owns(newItem.instanceHandle))
+				{
+					newItem.instanceHandle = 0;
+				}
+			}
+		}
+
+		//Whatever is being replaced and isn't coming back lets go of its instance data
+		for (int i = 0; i < inventoryArray.Num() && i < newInv.Num(); ++i)
+		{
+			if (!keptHandles.Contains(inventoryArray[i].instanceHandle))
+			{
+				instancePool.release(inventoryArray[i].instanceHandle);
+			}
+		}
+
+		replaceSlots(newInv);
+	}
+
+	broadcastInvChanged();
+}
+
+//Shaped items go back where they were if they still fit there, anything that doesn't moves to the first free spot or gets dropped
+//Returns true if anything had to move
+bool UInventoryComponent::replaceSlots(const TArray<FInvItem>& newInv)
+{
+	int numSlots = FMath::Min(inventoryArray.Num(), newInv.Num());
+
+	if (!useShapedItems)
+	{
+		for (int i = 0; i < numSlots; ++i)
+		{
+			setSlot(i, newInv[i]);
+		}
+
+		return false;
+	}
+
+	//Clear first so what was here before can't block the new layout
+	for (int i = 0; i < numSlots; ++i)
+	{
+		if (IsValid(inventoryArray[i].item))
+		{
+			setSlot(i, FInvItem());
+		}
+	}
+
+	TArray<int> displaced;
+	for (int i = 0; i < numSlots; ++i)
+	{
+		const FInvItem& newItem = newInv[i];
+
+		if (!IsValid(newItem.item))
+		{
+			continue;
+		}
+
+		if (canPlaceItemAt(newItem.item, i, newItem.rotated))
+		{
+			setSlot(i, newItem, newItem.rotated);
+		}
+		else
+		{
+			displaced.Add(i);
+		}
+	}
+
+	//Saved before a footprint changed, or by something that didn't keep the rotation
+	for (int i : displaced)
+	{
+		const FInvItem& newItem = newInv[i];
+		bool rotated = false;
+		int emptySlot = findEmptySlotFor(newItem.item, rotated);
+
+		if (emptySlot != -1)
+		{
+			setSlot(emptySlot, newItem, rotated);
+		}
+		else
+		{
+			createLootBag(newItem);
+			//Any instance data went to the bag with it, otherwise the item is lost
+			instancePool.release(newItem.instanceHandle);
+		}
+	}
+
+	return displaced.Num() > 0;
+}
+
+FInvItem UInventoryComponent::adoptItem(const FInvItem& newItem) const
+{
+	FInvItem adopted = newItem;
+
+	if (adopted.hasInstanceData())
+	{
+		bool inSlot = inventoryArray.ContainsByPredicate([&adopted](const FInvItem& slotItem) { return slotItem.instanceHandle == adopted.instanceHandle; });
+		if (inSlot || !instancePool.owns(adopted.instanceHandle))
+		{
+			adopted.instanceHandle = 0;
+		}
+	}
+
+	return adopted;
+}
+
+//First slot a new stack of this item can go in, in shaped mode this is the top left cell of a free spot
+int UInventoryComponent::findEmptySlotFor(UItemAsset* itemAsset, bool& outRotated)
+{
+	outRotated = false;
+
+	if (!useShapedItems)
+	{
+		if (emptySlots == 0)
+		{
+			return -1;
+		}
+
+		for (int i = 0; i < inventoryArray.Num(); ++i)
+		{
+			if (inventoryArray[i].item == nullptr)
+			{
+				return i;
+			}
+		}
+
+		return -1;
+	}
+
+	if (!IsValid(itemAsset))
+	{
+		return -1;
+	}
+
+	FIntPoint itemSize = itemAsset->getFootprint();
+	FInvGridPlacement placement;
+	bool found = useBestFit ? grid.findBestFit(itemSize.X, itemSize.Y, allowRotation, placement)
+		: grid.findFirstFit(itemSize.X, itemSize.Y, allowRotation, placement);
+
+	if (!found)
+	{
+		return -1;
+	}
+
+	outRotated = placement.rotated;
+	return placement.row * slotsPerRow + placement.column;
+}
+
+FInvGridPlacement UInventoryComponent::makePlacement(int slot, UItemAsset* itemAsset, bool rotated)
+{
+	FIntPoint itemSize = itemAsset->getFootprint();
+
+	FInvGridPlacement placement;
+	placement.column = slot % slotsPerRow;
+	placement.row = slot / slotsPerRow;
+	placement.width = rotated ? itemSize.Y : itemSize.X;
+	placement.height = rotated ? itemSize.X : itemSize.Y;
+	placement.rotated = rotated;
+	return placement;
+}
+
+FInvGridPlacement UInventoryComponent::getItemPlacement(int slot)
+{
+	FInvGridPlacement* placement = placements.Find(slot);
+	return placement ? *placement : FInvGridPlacement();
+}
+
+bool UInventoryComponent::canPlaceItemAt(UItemAsset* itemAsset, int slot, bool rotated)
+{
+	if (!IsValid(itemAsset) || slot < 0 || slot >= inventoryArray.Num())
+	{
+		return false;
+	}
+
+	if (!useShapedItems)
+	{
+		return inventoryArray[slot].item == nullptr;
+	}
+
+	FInvGridPlacement placement = makePlacement(slot, itemAsset, rotated);
+	return grid.canPlace(placement.column, placement.row, placement.width, placement.height);
+}
+
+bool UInventoryComponent::rotateItem(int slot)
+{
+	FInventoryTraceScope trace(this, EInventoryTraceOp::RotateItem, { slot });
+
+	FInvGridPlacement* placement = placements.Find(slot);
+
+	if (placement == nullptr || placement->width == placement->height)
+	{
+		return false;
+	}
+
+	//Lift the item out so it doesn't block itself
+	grid.setCells(*placement, false);
+	FInvGridPlacement turned = makePlacement(slot, inventoryArray[slot].item, !placement->rotated);
+
+	if (!grid.canPlace(turned.column, turned.row, turned.width, turned.height))
+	{
+		grid.setCells(*placement, true);
+		return false;
+	}
+
+	grid.setCells(turned, true);
+	*placement = turned;
+	inventoryArray[slot].rotated = turned.rotated;
+	snapshotDirty = true;
+
+	if (journal != nullptr)
+	{
+		journalSlot(slot);
+	}
+
+	broadcastInvChanged();
+	return true;
+}
+
+bool UInventoryComponent::moveShapedItem(int from, int to)
+{
+	FInvGridPlacement* placement = placements.Find(from);
+
+	if (placement == nullptr || from == to)
+	{
+		return false;
+	}
+
+	FInvGridPlacement lifted = *placement;
+	grid.setCells(lifted, false);
+	bool fits = grid.canPlace(to % slotsPerRow, to / slotsPerRow, lifted.width, lifted.height);
+	grid.setCells(lifted, true);
+
+	if (!fits)
+	{
+		return false;
+	}
+
+	FInvItem movingItem = inventoryArray[from];
+	setSlot(from, FInvItem());
+	setSlot(to, movingItem, lifted.rotated);
+	broadcastInvChanged();
+	return true;
+}
+
+void UInventoryComponent::setSlot(int slot, const FInvItem& newItem, bool rotated)
+{
+	applySlotToTotals(inventoryArray[slot], -1);
+
+	if (useShapedItems)
+	{
+		//Quantity changes on the same item keep whichever way it was turned
+		FInvGridPlacement placement;
+		if (placements.RemoveAndCopyValue(slot, placement))
+		{
+			grid.setCells(placement, false);
+			rotated = inventoryArray[slot].item == newItem.item ? placement.rotated : rotated;
+		}
+
+		if (IsValid(newItem.item))
+		{
+			placement = makePlacement(slot, newItem.item, rotated);
+			grid.setCells(placement, true);
+			placements.Add(slot, placement);
+		}
+	}
+
+	inventoryArray[slot] = newItem;
+	inventoryArray[slot].rotated = useShapedItems && IsValid(newItem.item) && rotated;
+	applySlotToTotals(inventoryArray[slot], 1);
+
+	if (journal != nullptr)
+	{
+		journalSlot(slot);
+	}
+}
+
+void UInventoryComponent::journalSlot(int slot)
+{
+	journal->recordSlot(journalKey, slot, inventoryArray[slot], instancePool.find(inventoryArray[slot].instanceHandle));
+}
+
+//Put back whatever the journal had for this inventory, nothing done while restoring gets journaled again
+void UInventoryComponent::restoreFromJournal()
+{
+	UInventoryJournalSubsystem* activeJournal = journal;
+	journal = nullptr;
+
+	const FJournalContainerState* savedInv = activeJournal->findRecoveredContainer(journalKey);
+	bool relocated = false;
+
+	if (savedInv != nullptr)
+	{
+		int savedRows = FMath::DivideAndRoundUp(savedInv->slots.Num(), slotsPerRow);
+		if (savedRows > getRows())
+		{
+			addNewRows(savedRows - getRows(), true);
+		}
+
+		TArray<FInvItem> restoredInv;
+		for (int i = 0; i < savedInv->slots.Num() && i < inventoryArray.Num(); ++i)
+		{
+			const FJournalSlotState& savedSlot = savedInv->slots[i];
+			FInvItem& restoredItem = restoredInv.AddDefaulted_GetRef();
+
+			if (savedSlot.hasItem)
+			{
+				restoredItem.item = activeJournal->resolveItem(savedSlot.itemId);
+				restoredItem.quantity = savedSlot.quantity;
+				restoredItem.rotated = savedSlot.rotated;
+
+				if (savedSlot.hasInstanceData && IsValid(restoredItem.item))
+				{
+					restoredItem.instanceHandle = instancePool.allocate(FItemInstanceData(savedSlot.instanceData));
+				}
+			}
+
+			instancePool.release(inventoryArray[i].instanceHandle);
+		}
+
+		relocated = replaceSlots(restoredInv);
+		broadcastInvChanged();
+	}
+
+	journal = activeJournal;
+
+	//Items that had to move are journaled where they are now
+	if (relocated)
 	{
 		for (int i = 0; i < inventoryArray.Num(); ++i)
 		{
-			inventoryArray[i] = newInv[i];
+			journalSlot(i);
 		}
 	}
 
+	//First time the journal sees this inventory, give it the starting size
+	if (savedInv == nullptr)
+	{
+		journal->recordResize(journalKey, inventoryArray.Num());
+	}
+}
+
+void UInventoryComponent::setSlotQuantity(int slot, int newQuantity)
+{
+	FInvItem updatedItem = inventoryArray[slot];
+	updatedItem.quantity = newQuantity;
+	setSlot(slot, updatedItem);
+}
+
+//Adds (sign 1) or takes away (sign -1) what a single slot contributes to the running totals
+void UInventoryComponent::applySlotToTotals(const FInvItem& slotItem, int sign)
+{
+	UItemAsset* itemAsset = slotItem.item;
+	snapshotDirty = true;
+
+	if (!IsValid(itemAsset))
+	{
+		emptySlots += sign;
+		return;
+	}
+
+	int freeSpace = slotItem.hasInstanceData() ? 0 : FMath::Max(FItemCatalog::getMaxStackSize(itemAsset) - slotItem.quantity, 0);
+
+	FInvItemTotals& itemTotal = itemTotals.FindOrAdd(itemAsset->uniqueID);
+	itemTotal.quantity += sign * slotItem.quantity;
+	itemTotal.stacks += sign;
+	itemTotal.freeSpace += sign * freeSpace;
+	if (itemTotal.stacks <= 0)
+	{
+		itemTotals.Remove(itemAsset->uniqueID);
+	}
+
+	FInvItemTotals& typeTotal = typeTotals.FindOrAdd(itemAsset->type);
+	typeTotal.quantity += sign * slotItem.quantity;
+	typeTotal.stacks += sign;
+	typeTotal.freeSpace += sign * freeSpace;
+	if (typeTotal.stacks <= 0)
+	{
+		typeTotals.Remove(itemAsset->type);
+	}
+
+	totalValue += sign * static_cast<int64>(FItemCatalog::getBuyPrice(itemAsset)) * slotItem.quantity;
+}
+
+void UInventoryComponent::broadcastInvChanged()
+{
+	if (batchDepth > 0)
+	{
+		broadcastPending = true;
+		return;
+	}
+
+	if (publishSnapshots && snapshotDirty)
+	{
+		snapshotDirty = false;
+		snapshotPublisher->publish(new FInventorySnapshot(inventoryArray, itemTotals, typeTotals, getAmountOfEmptySlots(), totalValue, ++snapshotVersion));
+	}
+	else
+	{
+		//Snapshots a publish couldn't free because of readers at the time
+		snapshotPublisher->releaseRetired();
+	}
+
 	OnInvChanged.Broadcast();
+}
+
+void UInventoryComponent::beginBatch()
+{
+	++batchDepth;
+}
+
+void UInventoryComponent::endBatch()
+{
+	if (batchDepth <= 0)
+	{
+		return;
+	}
+
+	--batchDepth;
+
+	if (batchDepth == 0 && broadcastPending)
+	{
+		broadcastPending = false;
+		broadcastInvChanged();
+	}
+}
+
+uint64 UInventoryComponent::getStateHash() const
+{
+	//FNV-1a over each slot's item ID, quantity and rotation, so a rotateItem that goes differently is caught too
+	uint64 hash = 14695981039346656037ull;
+	auto mix = [&hash](uint32 value)
+	{
+		hash = (hash ^ value) * 1099511628211ull;
+	};
+
+	for (const FInvItem& slotItem : inventoryArray)
+	{
+		bool hasItem = IsValid(slotItem.item);
+		mix(hasItem ? static_cast<uint32>(slotItem.item->uniqueID) : MAX_uint32);
+		mix(hasItem ? static_cast<uint32>(slotItem.quantity) : 0);
+		mix(hasItem ? slotItem.rotated : 0);
+	}
+
+	return hash;
 }
\ No newline at end of file
@@ -0,0 +1,166 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "InventoryGrid.h"
+
+void FInventoryGrid::reset(int numColumns, int numRows)
+{
+	columns = FMath::Clamp(numColumns, 1, maxColumns);
+	fullRow = columns == maxColumns ? ~0ull : (1ull << columns) - 1;
+	occupiedCells = 0;
+	rowBits.Reset();
+	addRows(numRows);
+}
+
+void FInventoryGrid::addRows(int numRows)
+{
+	for (int i = 0; i < numRows; ++i)
+	{
+		rowBits.Add(0);
+	}
+}
+
+uint64 FInventoryGrid::spanMask(int column, int width) const
+{
+	if (width >= maxColumns)
+	{
+		return ~0ull;
+	}
+
+	return ((1ull << width) - 1) << column;
+}
+
+bool FInventoryGrid::canPlace(int column, int row, int width, int height) const
+{
+	if (column < 0 || row < 0 || width <= 0 || height <= 0 || column + width > columns || row + height > rowBits.Num())
+	{
+		return false;
+	}
+
+	uint64 mask = spanMask(column, width);
+	for (int i = row; i < row + height; ++i)
+	{
+		if (rowBits[i] & mask)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void FInventoryGrid::setCells(const FInvGridPlacement& placement, bool occupied)
+{
+	uint64 mask = spanMask(placement.column, placement.width) & fullRow;
+
+	for (int i = placement.row; i < placement.row + placement.height && i < rowBits.Num(); ++i)
+	{
+		uint64 changed = occupied ? (mask & ~rowBits[i]) : (mask & rowBits[i]);
+		occupiedCells += (occupied ? 1 : -1) * FMath::CountBits(changed);
+		rowBits[i] = occupied ? (rowBits[i] | mask) : (rowBits[i] & ~mask);
+	}
+}
+
+uint64 FInventoryGrid::fitStarts(int row, int width, int height) const
+{
+	if (width <= 0 || height <= 0 || width > columns || row + height > rowBits.Num())
+	{
+		return 0;
+	}
+
+	uint64 used = 0;
+	for (int i = row; i < row + height; ++i)
+	{
+		used |= rowBits[i];
+	}
+
+	//Shift the free mask over itself so only bits with width free cells to their left survive
+	uint64 freeCells = ~used & fullRow;
+	uint64 starts = freeCells;
+	for (int i = 1; i < width; ++i)
+	{
+		starts &= freeCells >> i;
+	}
+
+	return starts;
+}
+
+bool FInventoryGrid::findFirstFit(int width, int height, bool allowRotation, FInvGridPlacement& outPlacement) const
+{
+	bool tryRotated = allowRotation && width != height;
+
+	for (int row = 0; row < rowBits.Num(); ++row)
+	{
+		for (int rotation = 0; rotation < (tryRotated ? 2 : 1); ++rotation)
+		{
+			int curWidth = rotation == 0 ? width : height;
+			int curHeight = rotation == 0 ? height : width;
+			uint64 starts = fitStarts(row, curWidth, curHeight);
+
+			if (starts != 0)
+			{
+				outPlacement.column = static_cast<int>(FMath::CountTrailingZeros64(starts));
+				outPlacement.row = row;
+				outPlacement.width = curWidth;
+				outPlacement.height = curHeight;
+				outPlacement.rotated = rotation == 1;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+bool FInventoryGrid::findBestFit(int width, int height, bool allowRotation, FInvGridPlacement& outPlacement) const
+{
+	bool tryRotated = allowRotation && width != height;
+	int bestScore = -1;
+
+	for (int row = 0; row < rowBits.Num(); ++row)
+	{
+		for (int rotation = 0; rotation < (tryRotated ? 2 : 1); ++rotation)
+		{
+			int curWidth = rotation == 0 ? width : height;
+			int curHeight = rotation == 0 ? height : width;
+			uint64 starts = fitStarts(row, curWidth, curHeight);
+
+			while (starts != 0)
+			{
+				int column = static_cast<int>(FMath::CountTrailingZeros64(starts));
+				starts &= starts - 1;
+
+				int score = contactScore(column, row, curWidth, curHeight);
+				if (score > bestScore)
+				{
+					bestScore = score;
+					outPlacement.column = column;
+					outPlacement.row = row;
+					outPlacement.width = curWidth;
+					outPlacement.height = curHeight;
+					outPlacement.rotated = rotation == 1;
+				}
+			}
+		}
+	}
+
+	return bestScore >= 0;
+}
+
+//Count of neighbouring cells around the item that are taken or off the grid
+int FInventoryGrid::contactScore(int column, int row, int width, int height) const
+{
+	uint64 mask = spanMask(column, width);
+	int score = 0;
+
+	score += row == 0 ? width : FMath::CountBits(rowBits[row - 1] & mask);
+	score += row + height == rowBits.Num() ? width : FMath::CountBits(rowBits[row + height] & mask);
+
+	for (int i = row; i < row + height; ++i)
+	{
+		score += column == 0 ? 1 : static_cast<int>((rowBits[i] >> (column - 1)) & 1);
+		score += column + width == columns ? 1 : static_cast<int>((rowBits[i] >> (column + width)) & 1);
+	}
+
+	return score;
+}
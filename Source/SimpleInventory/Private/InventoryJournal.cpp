@@ -0,0 +1,434 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "InventoryJournal.h"
+#include "HAL/FileManager.h"
+#include "Misc/Crc.h"
+#include "Misc/FileHelper.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace InventoryJournal
+{
+	static const uint32 segmentMagic = 0x4C4E4A49; //IJNL
+	static const uint32 checkpointMagic = 0x504B4349; //ICKP
+	static const uint32 formatVersion = 1;
+
+	enum class EOp : uint8
+	{
+		Container = 1,
+		ItemPath = 2,
+		Slot = 3,
+		Resize = 4,
+		Remove = 5
+	};
+
+	static void serializeSlot(FArchive& ar, FJournalSlotState& slotState)
+	{
+		//Rotation shares the byte, older journals only ever wrote 0 or 1 here
+		uint8 itemFlags = (slotState.hasItem ? 1 : 0) | (slotState.rotated ? 2 : 0);
+		ar << itemFlags;
+		slotState.hasItem = (itemFlags & 1) != 0;
+		slotState.rotated = (itemFlags & 2) != 0;
+
+		if (!slotState.hasItem)
+		{
+			return;
+		}
+
+		ar << slotState.itemId;
+		ar << slotState.quantity;
+
+		uint8 hasInstanceData = slotState.hasInstanceData ? 1 : 0;
+		ar << hasInstanceData;
+		slotState.hasInstanceData = hasInstanceData != 0;
+
+		if (slotState.hasInstanceData)
+		{
+			FInventoryJournalFile::serializeInstanceData(ar, slotState.instanceData);
+		}
+	}
+
+	static void serializeState(FArchive& ar, FJournalState& state)
+	{
+		ar << state.lastSequence;
+
+		int32 numContainers = state.containers.Num();
+		ar << numContainers;
+
+		if (ar.IsLoading())
+		{
+			for (int32 i = 0; i < numContainers && !ar.IsError(); ++i)
+			{
+				FString containerId;
+				int32 numSlots = 0;
+				ar << containerId;
+				ar << numSlots;
+
+				FJournalContainerState& container = state.containers.FindOrAdd(containerId);
+				container.slots.SetNum(FMath::Max(numSlots, 0));
+				for (FJournalSlotState& slotState : container.slots)
+				{
+					serializeSlot(ar, slotState);
+				}
+			}
+		}
+		else
+		{
+			for (TPair<FString, FJournalContainerState>& container : state.containers)
+			{
+				int32 numSlots = container.Value.slots.Num();
+				ar << container.Key;
+				ar << numSlots;
+
+				for (FJournalSlotState& slotState : container.Value.slots)
+				{
+					serializeSlot(ar, slotState);
+				}
+			}
+		}
+
+		ar << state.itemPaths;
+	}
+}
+
+void FInventoryJournalFile::serializeInstanceData(FArchive& ar, FItemInstanceData& data)
+{
+	ar << data.durability;
+	ar << data.rolledStats;
+	ar << data.owner;
+}
+
+bool FInventoryJournalFile::readCheckpoint(const FString& path, FJournalState& outState)
+{
+	TArray<uint8> fileData;
+	if (!FFileHelper::LoadFileToArray(fileData, *path, FILEREAD_Silent))
+	{
+		return false;
+	}
+
+	FMemoryReader reader(fileData);
+	uint32 magic = 0;
+	uint32 version = 0;
+	uint32 bodyCrc = 0;
+	reader << magic;
+	reader << version;
+	reader << bodyCrc;
+
+	int64 bodyStart = reader.Tell();
+	if (reader.IsError() || magic != InventoryJournal::checkpointMagic || version != InventoryJournal::formatVersion
+		|| FCrc::MemCrc32(fileData.GetData() + bodyStart, fileData.Num() - bodyStart) != bodyCrc)
+	{
+		return false;
+	}
+
+	FJournalState loadedState;
+	InventoryJournal::serializeState(reader, loadedState);
+	if (reader.IsError())
+	{
+		return false;
+	}
+
+	outState = MoveTemp(loadedState);
+	return true;
+}
+
+bool FInventoryJournalFile::writeCheckpoint(const FString& path, const FJournalState& state)
+{
+	TArray<uint8> body;
+	FMemoryWriter bodyWriter(body);
+	InventoryJournal::serializeState(bodyWriter, const_cast<FJournalState&>(state));
+
+	TArray<uint8> fileData;
+	FMemoryWriter writer(fileData);
+	uint32 magic = InventoryJournal::checkpointMagic;
+	uint32 version = InventoryJournal::formatVersion;
+	uint32 bodyCrc = FCrc::MemCrc32(body.GetData(), body.Num());
+	writer << magic;
+	writer << version;
+	writer << bodyCrc;
+	writer.Serialize(body.GetData(), body.Num());
+
+	//Rename over the old one only once the new one is fully on disk
+	FString tempPath = path + TEXT(".tmp");
+	if (!FFileHelper::SaveArrayToFile(fileData, *tempPath))
+	{
+		return false;
+	}
+
+	return IFileManager::Get().Move(*path, *tempPath, true, true);
+}
+
+void FInventoryJournalFile::recover(const FString& checkpointPath, TArrayView<const FString> segmentPaths, FJournalState& outState)
+{
+	readCheckpoint(checkpointPath, outState);
+
+	uint64 checkpointSequence = outState.lastSequence;
+	for (const FString& segmentPath : segmentPaths)
+	{
+		replaySegment(segmentPath, outState, checkpointSequence);
+	}
+}
+
+void FInventoryJournalFile::replaySegment(const FString& path, FJournalState& state, uint64 skipUpTo)
+{
+	TArray<uint8> fileData;
+	if (!FFileHelper::LoadFileToArray(fileData, *path, FILEREAD_Silent))
+	{
+		return;
+	}
+
+	FMemoryReader reader(fileData);
+	uint32 magic = 0;
+	uint32 version = 0;
+	reader << magic;
+	reader << version;
+
+	if (reader.IsError() || magic != InventoryJournal::segmentMagic || version != InventoryJournal::formatVersion)
+	{
+		return;
+	}
+
+	TArray<FString> containerIds;
+
+	while (reader.TotalSize() - reader.Tell() >= 8)
+	{
+		uint32 payloadSize = 0;
+		uint32 payloadCrc = 0;
+		reader << payloadSize;
+		reader << payloadCrc;
+
+		int64 payloadStart = reader.Tell();
+		if (payloadSize > reader.TotalSize() - payloadStart || FCrc::MemCrc32(fileData.GetData() + payloadStart, payloadSize) != payloadCrc)
+		{
+			//Torn write from a crash, nothing after this can be trusted
+			return;
+		}
+
+		FMemoryReaderView payload(MakeArrayView(fileData.GetData() + payloadStart, payloadSize));
+		reader.Seek(payloadStart + payloadSize);
+
+		uint8 op = 0;
+		payload << op;
+
+		switch (static_cast<InventoryJournal::EOp>(op))
+		{
+		case InventoryJournal::EOp::Container:
+		{
+			uint32 containerIndex = 0;
+			FString containerId;
+			payload << containerIndex;
+			payload << containerId;
+
+			if (containerIds.Num() <= static_cast<int32>(containerIndex))
+			{
+				containerIds.SetNum(containerIndex + 1);
+			}
+			containerIds[containerIndex] = containerId;
+			break;
+		}
+		case InventoryJournal::EOp::ItemPath:
+		{
+			int32 itemId = 0;
+			FString itemPath;
+			payload << itemId;
+			payload << itemPath;
+			state.itemPaths.Add(itemId, itemPath);
+			break;
+		}
+		case InventoryJournal::EOp::Slot:
+		case InventoryJournal::EOp::Resize:
+		case InventoryJournal::EOp::Remove:
+		{
+			uint64 sequence = 0;
+			uint32 containerIndex = 0;
+			int32 value = 0;
+			payload << sequence;
+			payload << containerIndex;
+			payload << value;
+
+			if (sequence <= skipUpTo || !containerIds.IsValidIndex(containerIndex) || value < 0)
+			{
+				break;
+			}
+
+			state.lastSequence = FMath::Max(state.lastSequence, sequence);
+
+			if (static_cast<InventoryJournal::EOp>(op) == InventoryJournal::EOp::Remove)
+			{
+				state.containers.Remove(containerIds[containerIndex]);
+				break;
+			}
+
+			FJournalContainerState& container = state.containers.FindOrAdd(containerIds[containerIndex]);
+
+			if (static_cast<InventoryJournal::EOp>(op) == InventoryJournal::EOp::Resize)
+			{
+				container.slots.SetNum(value);
+			}
+			else
+			{
+				FJournalSlotState slotState;
+				InventoryJournal::serializeSlot(payload, slotState);
+
+				if (container.slots.Num() <= value)
+				{
+					container.slots.SetNum(value + 1);
+				}
+				container.slots[value] = MoveTemp(slotState);
+			}
+			break;
+		}
+		default:
+			return;
+		}
+	}
+}
+
+FInventoryJournalWriter::~FInventoryJournalWriter()
+{
+	close();
+}
+
+bool FInventoryJournalWriter::open(const FString& path)
+{
+	close();
+
+	file.Reset(IFileManager::Get().CreateFileWriter(*path, FILEWRITE_Append | FILEWRITE_AllowRead));
+	if (!file.IsValid())
+	{
+		return false;
+	}
+
+	if (file->TotalSize() == 0)
+	{
+		uint32 magic = InventoryJournal::segmentMagic;
+		uint32 version = InventoryJournal::formatVersion;
+		*file << magic;
+		*file << version;
+		file->Flush();
+	}
+
+	return true;
+}
+
+void FInventoryJournalWriter::close()
+{
+	if (file.IsValid())
+	{
+		flush();
+		file->Close();
+		file.Reset();
+	}
+
+	pending.Reset();
+	containerIndices.Reset();
+}
+
+void FInventoryJournalWriter::appendSlot(uint64 sequence, const FString& containerId, int32 slot, const FJournalSlotState& slotState)
+{
+	uint32 containerIndex = internContainer(containerId);
+
+	TArray<uint8> payload;
+	FMemoryWriter writer(payload);
+	uint8 op = static_cast<uint8>(InventoryJournal::EOp::Slot);
+	writer << op;
+	writer << sequence;
+	writer << containerIndex;
+	writer << slot;
+	InventoryJournal::serializeSlot(writer, const_cast<FJournalSlotState&>(slotState));
+
+	appendRecord(payload);
+}
+
+void FInventoryJournalWriter::appendResize(uint64 sequence, const FString& containerId, int32 numSlots)
+{
+	uint32 containerIndex = internContainer(containerId);
+
+	TArray<uint8> payload;
+	FMemoryWriter writer(payload);
+	uint8 op = static_cast<uint8>(InventoryJournal::EOp::Resize);
+	writer << op;
+	writer << sequence;
+	writer << containerIndex;
+	writer << numSlots;
+
+	appendRecord(payload);
+}
+
+void FInventoryJournalWriter::appendRemove(uint64 sequence, const FString& containerId)
+{
+	uint32 containerIndex = internContainer(containerId);
+
+	TArray<uint8> payload;
+	FMemoryWriter writer(payload);
+	uint8 op = static_cast<uint8>(InventoryJournal::EOp::Remove);
+	int32 unused = 0;
+	writer << op;
+	writer << sequence;
+	writer << containerIndex;
+	writer << unused;
+
+	appendRecord(payload);
+}
+
+void FInventoryJournalWriter::appendItemPath(int32 itemId, const FString& path)
+{
+	TArray<uint8> payload;
+	FMemoryWriter writer(payload);
+	uint8 op = static_cast<uint8>(InventoryJournal::EOp::ItemPath);
+	writer << op;
+	writer << itemId;
+	writer << const_cast<FString&>(path);
+
+	appendRecord(payload);
+}
+
+uint32 FInventoryJournalWriter::internContainer(const FString& containerId)
+{
+	if (const uint32* existingIndex = containerIndices.Find(containerId))
+	{
+		return *existingIndex;
+	}
+
+	uint32 containerIndex = containerIndices.Num();
+	containerIndices.Add(containerId, containerIndex);
+
+	TArray<uint8> payload;
+	FMemoryWriter writer(payload);
+	uint8 op = static_cast<uint8>(InventoryJournal::EOp::Container);
+	writer << op;
+	writer << containerIndex;
+	writer << const_cast<FString&>(containerId);
+
+	appendRecord(payload);
+	return containerIndex;
+}
+
+void FInventoryJournalWriter::appendRecord(const TArray<uint8>& payload)
+{
+	uint32 payloadSize = payload.Num();
+	uint32 payloadCrc = FCrc::MemCrc32(payload.GetData(), payload.Num());
+
+	FMemoryWriter writer(pending, false, true);
+	writer << payloadSize;
+	writer << payloadCrc;
+	writer.Serialize(const_cast<uint8*>(payload.GetData()), payload.Num());
+}
+
+bool FInventoryJournalWriter::flush()
+{
+	if (!file.IsValid())
+	{
+		return false;
+	}
+
+	if (pending.Num() > 0)
+	{
+		file->Serialize(pending.GetData(), pending.Num());
+		pending.Reset();
+	}
+
+	file->Flush();
+	return !file->IsError();
+}
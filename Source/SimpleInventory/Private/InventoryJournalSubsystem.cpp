@@ -0,0 +1,263 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "InventoryJournalSubsystem.h"
+#include "InventoryItem.h"
+#include "Async/Async.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/Paths.h"
+#include "Misc/PackageName.h"
+#include "Engine/World.h"
+
+static TAutoConsoleVariable<float> CVarInventoryJournalFlushInterval(
+	TEXT("SimpleInventory.JournalFlushInterval"),
+	1.0f,
+	TEXT("Seconds between writing buffered inventory journal records to disk, 0 or less only writes on flushJournal."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarInventoryJournalCheckpointInterval(
+	TEXT("SimpleInventory.JournalCheckpointInterval"),
+	60.0f,
+	TEXT("Seconds between folding the inventory journal into its checkpoint, 0 or less turns it off."),
+	ECVF_Default);
+
+bool UInventoryJournalSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	if (!Super::ShouldCreateSubsystem(Outer))
+	{
+		return false;
+	}
+
+	//Clients only hold replicated copies, the server journals the real ones. Client worlds don't always know their
+	//net mode this early, so startJournal checks authority again
+	UWorld* world = Cast<UWorld>(Outer);
+	return world != nullptr && world->IsGameWorld() && world->GetNetMode() != NM_Client;
+}
+
+TStatId UInventoryJournalSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UInventoryJournalSubsystem, STATGROUP_Tickables);
+}
+
+void UInventoryJournalSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	FString mapName = UWorld::RemovePIEPrefix(FPackageName::GetShortName(GetWorld()->GetOutermost()->GetName()));
+	journalDir = FPaths::ProjectSavedDir() / TEXT("InventoryJournal") / mapName;
+
+	//Every PIE instance of the map gets its own folder, otherwise they all append to the same segment at once
+	int32 pieInstance = GetWorld()->GetOutermost()->GetPIEInstanceID();
+	if (pieInstance != INDEX_NONE)
+	{
+		journalDir = journalDir / FString::Printf(TEXT("PIE_%d"), pieInstance);
+	}
+	IFileManager::Get().MakeDirectory(*journalDir, true);
+
+	//Checkpoint first, then every segment left over in order
+	TArray<FString> segmentFiles;
+	IFileManager::Get().FindFiles(segmentFiles, *(journalDir / TEXT("journal_*.bin")), true, false);
+
+	for (const FString& segmentFile : segmentFiles)
+	{
+		int32 segment = FCString::Atoi(*FPaths::GetBaseFilename(segmentFile).RightChop(8));
+		closedSegments.Add(segment);
+	}
+	closedSegments.Sort();
+
+	TArray<FString> segmentPaths;
+	for (int32 segment : closedSegments)
+	{
+		segmentPaths.Add(getSegmentPath(segment));
+	}
+	FInventoryJournalFile::recover(getCheckpointPath(), segmentPaths, recovered);
+
+	for (const TPair<int32, FString>& itemPath : recovered.itemPaths)
+	{
+		writtenItemPaths.Add(itemPath.Key);
+	}
+
+	sequence = recovered.lastSequence;
+	currentSegment = closedSegments.Num() > 0 ? closedSegments.Last() + 1 : 0;
+	writer.open(getSegmentPath(currentSegment));
+}
+
+void UInventoryJournalSubsystem::Deinitialize()
+{
+	writer.close();
+
+	if (foldTask.IsValid())
+	{
+		foldTask.Wait();
+	}
+
+	Super::Deinitialize();
+}
+
+void UInventoryJournalSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	float flushInterval = CVarInventoryJournalFlushInterval.GetValueOnGameThread();
+	timeSinceFlush += DeltaTime;
+	if (flushInterval > 0 && timeSinceFlush >= flushInterval && writer.getPendingBytes() > 0)
+	{
+		flushJournal();
+	}
+
+	//Fold finished, the segments it covered are gone if it worked and get retried next time if not
+	if (foldTask.IsValid() && foldTask.IsReady())
+	{
+		if (!foldTask.Get())
+		{
+			closedSegments.Append(foldingSegments);
+			closedSegments.Sort();
+		}
+
+		foldingSegments.Reset();
+		foldTask = TFuture<bool>();
+	}
+
+	float checkpointInterval = CVarInventoryJournalCheckpointInterval.GetValueOnGameThread();
+	timeSinceCheckpoint += DeltaTime;
+	if (checkpointInterval > 0 && timeSinceCheckpoint >= checkpointInterval)
+	{
+		requestCheckpoint();
+	}
+}
+
+void UInventoryJournalSubsystem::recordSlot(const FString& containerId, int slot, const FInvItem& slotItem, const FItemInstanceData* instanceData)
+{
+	if (!writer.isOpen())
+	{
+		return;
+	}
+
+	FJournalSlotState slotState;
+
+	if (IsValid(slotItem.item))
+	{
+		slotState.hasItem = true;
+		slotState.itemId = slotItem.item->uniqueID;
+		slotState.quantity = slotItem.quantity;
+		slotState.rotated = slotItem.rotated;
+
+		if (instanceData != nullptr)
+		{
+			slotState.hasInstanceData = true;
+			slotState.instanceData = *instanceData;
+		}
+
+		if (!writtenItemPaths.Contains(slotState.itemId))
+		{
+			writtenItemPaths.Add(slotState.itemId);
+			writer.appendItemPath(slotState.itemId, FSoftObjectPath(slotItem.item).ToString());
+		}
+	}
+
+	writer.appendSlot(++sequence, containerId, slot, slotState);
+}
+
+void UInventoryJournalSubsystem::recordResize(const FString& containerId, int numSlots)
+{
+	if (writer.isOpen())
+	{
+		writer.appendResize(++sequence, containerId, numSlots);
+	}
+}
+
+void UInventoryJournalSubsystem::recordRemove(const FString& containerId)
+{
+	//Also forget it here so something taking the same key later this session starts empty
+	recovered.containers.Remove(containerId);
+
+	if (writer.isOpen())
+	{
+		writer.appendRemove(++sequence, containerId);
+	}
+}
+
+const FJournalContainerState* UInventoryJournalSubsystem::findRecoveredContainer(const FString& containerId) const
+{
+	return recovered.containers.Find(containerId);
+}
+
+UItemAsset* UInventoryJournalSubsystem::resolveItem(int32 itemId)
+{
+	if (UItemAsset** resolvedItem = resolvedItems.Find(itemId))
+	{
+		return *resolvedItem;
+	}
+
+	const FString* itemPath = recovered.itemPaths.Find(itemId);
+	UItemAsset* itemAsset = itemPath ? Cast<UItemAsset>(FSoftObjectPath(*itemPath).TryLoad()) : nullptr;
+	resolvedItems.Add(itemId, itemAsset);
+	return itemAsset;
+}
+
+bool UInventoryJournalSubsystem::flushJournal()
+{
+	timeSinceFlush = 0;
+	return writer.flush();
+}
+
+void UInventoryJournalSubsystem::requestCheckpoint()
+{
+	timeSinceCheckpoint = 0;
+
+	if (foldTask.IsValid())
+	{
+		return;
+	}
+
+	//Close off the current segment so the fold only ever reads files nothing is writing to
+	writer.close();
+	closedSegments.Add(currentSegment);
+	writer.open(getSegmentPath(++currentSegment));
+
+	startFold();
+}
+
+void UInventoryJournalSubsystem::startFold()
+{
+	foldingSegments = MoveTemp(closedSegments);
+	closedSegments.Reset();
+
+	TArray<FString> segmentPaths;
+	for (int32 segment : foldingSegments)
+	{
+		segmentPaths.Add(getSegmentPath(segment));
+	}
+
+	FString checkpointPath = getCheckpointPath();
+
+	foldTask = Async(EAsyncExecution::ThreadPool, [checkpointPath, segmentPaths]()
+	{
+		FJournalState state;
+		FInventoryJournalFile::recover(checkpointPath, segmentPaths, state);
+
+		if (!FInventoryJournalFile::writeCheckpoint(checkpointPath, state))
+		{
+			return false;
+		}
+
+		//Safe to lose these now, anything left behind by a crash here is skipped by sequence on the next replay
+		for (const FString& segmentPath : segmentPaths)
+		{
+			IFileManager::Get().Delete(*segmentPath, false, true, true);
+		}
+
+		return true;
+	});
+}
+
+FString UInventoryJournalSubsystem::getSegmentPath(int32 segment) const
+{
+	return journalDir / FString::Printf(TEXT("journal_%06d.bin"), segment);
+}
+
+FString UInventoryJournalSubsystem::getCheckpointPath() const
+{
+	return journalDir / TEXT("checkpoint.bin");
+}
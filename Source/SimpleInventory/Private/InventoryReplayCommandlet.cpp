@@ -0,0 +1,330 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "InventoryReplayCommandlet.h"
+#include "InventoryComponent.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "GameFramework/WorldSettings.h"
+#include "Components/SceneComponent.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogInventoryReplay, Log, All);
+
+UInventoryReplayCommandlet::UInventoryReplayCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+}
+
+int32 UInventoryReplayCommandlet::Main(const FString& Params)
+{
+	FString tracePath;
+	if (!FParse::Value(*Params, TEXT("Trace="), tracePath))
+	{
+		UE_LOG(LogInventoryReplay, Error, TEXT("Usage: -run=InventoryReplay -Trace=<file> [-Repeat=<count>]"));
+		return 1;
+	}
+
+	FInventoryTrace trace;
+	if (!FInventoryTrace::load(tracePath, trace))
+	{
+		UE_LOG(LogInventoryReplay, Error, TEXT("Could not read inventory trace %s"), *tracePath);
+		return 1;
+	}
+
+	int32 repeat = 1;
+	FParse::Value(*Params, TEXT("Repeat="), repeat);
+	repeat = FMath::Max(repeat, 1);
+
+	int32 mismatches = replayTrace(trace, repeat);
+
+	double msPerCycle = FPlatformTime::GetSecondsPerCycle64() * 1000.0;
+	double recordedMsPerCycle = trace.secondsPerCycle * 1000.0;
+
+	UE_LOG(LogInventoryReplay, Display, TEXT("Replayed %d calls on %d inventories %d time(s) from %s"), trace.calls.Num(), trace.components.Num(), repeat, *tracePath);
+	UE_LOG(LogInventoryReplay, Display, TEXT("%-22s %8s %10s %10s %10s %12s"), TEXT("Call"), TEXT("Count"), TEXT("Total ms"), TEXT("Avg us"), TEXT("Max us"), TEXT("Recorded us"));
+
+	for (int32 op = 0; op < stats.Num(); ++op)
+	{
+		const FOpStats& opStats = stats[op];
+		if (opStats.count == 0)
+		{
+			continue;
+		}
+
+		double totalMs = opStats.totalCycles * msPerCycle;
+		UE_LOG(LogInventoryReplay, Display, TEXT("%-22s %8d %10.3f %10.3f %10.3f %12.3f"),
+			FInventoryTrace::getOpName(static_cast<EInventoryTraceOp>(op)),
+			opStats.count,
+			totalMs,
+			totalMs * 1000.0 / opStats.count,
+			opStats.maxCycles * msPerCycle * 1000.0,
+			opStats.recordedCycles * recordedMsPerCycle * 1000.0 / opStats.count);
+	}
+
+	if (mismatches > 0)
+	{
+		UE_LOG(LogInventoryReplay, Error, TEXT("%d call(s) ended with a different state than recorded"), mismatches);
+		return 1;
+	}
+
+	UE_LOG(LogInventoryReplay, Display, TEXT("All state hashes matched"));
+	return 0;
+}
+
+UWorld* UInventoryReplayCommandlet::createWorld()
+{
+	UWorld* world = UWorld::CreateWorld(EWorldType::Game, false, TEXT("InventoryReplay"));
+	FWorldContext& worldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+	worldContext.SetCurrentWorld(world);
+	world->InitializeActorsForPlay(FURL());
+	world->BeginPlay();
+
+	//There is no game mode here to start the match, so dispatch begin play the way it would, anything spawned after this begins play on spawn
+	if (!world->HasBegunPlay())
+	{
+		world->GetWorldSettings()->NotifyBeginPlay();
+	}
+
+	return world;
+}
+
+void UInventoryReplayCommandlet::destroyWorld(UWorld* world)
+{
+	GEngine->DestroyWorldContext(world);
+	world->DestroyWorld(false);
+	CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+}
+
+int32 UInventoryReplayCommandlet::replayTrace(const FInventoryTrace& trace, int32 repeat)
+{
+	TArray<UItemAsset*> rootedItems;
+
+	for (const TPair<int32, FString>& itemPath : trace.itemPaths)
+	{
+		UItemAsset* itemAsset = Cast<UItemAsset>(FSoftObjectPath(itemPath.Value).TryLoad());
+		if (itemAsset == nullptr)
+		{
+			UE_LOG(LogInventoryReplay, Warning, TEXT("Item %d at %s is missing, calls using it won't match"), itemPath.Key, *itemPath.Value);
+			continue;
+		}
+
+		//Kept loaded through the garbage collection between repeats
+		if (!itemAsset->IsRooted())
+		{
+			itemAsset->AddToRoot();
+			rootedItems.Add(itemAsset);
+		}
+		items.Add(itemPath.Key, itemAsset);
+	}
+
+	stats.Reset();
+	stats.SetNum(static_cast<int32>(EInventoryTraceOp::Count));
+	int32 mismatches = 0;
+
+	for (int32 run = 0; run < repeat; ++run)
+	{
+		UWorld* world = createWorld();
+
+		//Inventories are spawned the first time a call uses them, same as they were first seen while recording
+		TArray<UInventoryComponent*> comps;
+		comps.SetNumZeroed(trace.components.Num());
+
+		auto findComponent = [&](int32 index) -> UInventoryComponent*
+		{
+			if (!trace.components.IsValidIndex(index))
+			{
+				return nullptr;
+			}
+
+			if (comps[index] == nullptr)
+			{
+				comps[index] = spawnComponent(world, trace.components[index]);
+			}
+
+			return comps[index];
+		};
+
+		for (int32 i = 0; i < trace.calls.Num(); ++i)
+		{
+			const FInventoryTraceCall& call = trace.calls[i];
+			UInventoryComponent* comp = findComponent(call.component);
+			UInventoryComponent* other = findComponent(call.otherComponent);
+
+			if (comp == nullptr)
+			{
+				++mismatches;
+				continue;
+			}
+
+			uint64 cycles = replayCall(call, comp, other);
+
+			FOpStats& opStats = stats[static_cast<int32>(call.op)];
+			++opStats.count;
+			opStats.totalCycles += cycles;
+			opStats.maxCycles = FMath::Max(opStats.maxCycles, cycles);
+			opStats.recordedCycles += call.durationCycles;
+
+			uint64 stateHash = comp->getStateHash();
+			if (stateHash != call.stateHash)
+			{
+				//Everything after the first mismatch on an inventory tends to mismatch too, so only the first few are worth reading
+				if (mismatches < 20)
+				{
+					UE_LOG(LogInventoryReplay, Error, TEXT("Call %d %s on %s: state hash %016llx, recorded %016llx"),
+						i, FInventoryTrace::getOpName(call.op), *trace.components[call.component].name, stateHash, call.stateHash);
+				}
+				++mismatches;
+			}
+		}
+
+		destroyWorld(world);
+	}
+
+	for (UItemAsset* itemAsset : rootedItems)
+	{
+		itemAsset->RemoveFromRoot();
+	}
+	items.Reset();
+
+	return mismatches;
+}
+
+UInventoryComponent* UInventoryReplayCommandlet::spawnComponent(UWorld* world, const FInventoryTraceComponent& traced)
+{
+	AActor* owner = world->SpawnActor<AActor>(AActor::StaticClass(), FTransform(traced.location));
+	if (owner == nullptr)
+	{
+		return nullptr;
+	}
+
+	//Loot bags drop at the owner's location, so it needs a root to have one
+	USceneComponent* root = NewObject<USceneComponent>(owner, TEXT("Root"));
+	owner->SetRootComponent(root);
+	root->RegisterComponent();
+	owner->SetActorLocation(traced.location);
+
+	UInventoryComponent* comp = NewObject<UInventoryComponent>(owner);
+	comp->inventoryRows = traced.rows;
+	comp->maxInventoryRows = traced.maxRows;
+	comp->slotsPerRow = traced.slotsPerRow;
+	comp->useShapedItems = traced.useShapedItems;
+	comp->allowRotation = traced.allowRotation;
+	comp->useBestFit = traced.useBestFit;
+	comp->mergeDist = traced.mergeDist;
+	comp->lootBag = traced.lootBagClass.IsEmpty() ? nullptr : FSoftClassPath(traced.lootBagClass).TryLoadClass<AActor>();
+	comp->journalChanges = false;
+
+	//The owner has already begun play so this runs BeginPlay and adds the starting rows
+	owner->AddInstanceComponent(comp);
+	comp->RegisterComponent();
+
+	if (!comp->HasBegunPlay())
+	{
+		UE_LOG(LogInventoryReplay, Error, TEXT("%s did not begin play, it can't be replayed"), *traced.name);
+		return nullptr;
+	}
+
+	for (int32 i = 0; i < traced.slots.Num() && i < comp->inventoryArray.Num(); ++i)
+	{
+		if (traced.slots[i].itemId != -1)
+		{
+			comp->setSlot(i, makeItem(traced.slots[i]), traced.slots[i].rotated);
+		}
+	}
+
+	comp->broadcastInvChanged();
+	return comp;
+}
+
+FInvItem UInventoryReplayCommandlet::makeItem(const FInventoryTraceSlot& slot) const
+{
+	FInvItem item;
+	UItemAsset* const* itemAsset = items.Find(slot.itemId);
+
+	if (itemAsset != nullptr)
+	{
+		item.item = *itemAsset;
+		item.quantity = slot.quantity;
+		//loadInventory puts shaped items back the way they were turned
+		item.rotated = slot.rotated;
+	}
+
+	return item;
+}
+
+uint64 UInventoryReplayCommandlet::replayCall(const FInventoryTraceCall& call, UInventoryComponent* comp, UInventoryComponent* other)
+{
+	auto arg = [&call](int32 index)
+	{
+		return call.args.IsValidIndex(index) ? call.args[index] : 0;
+	};
+
+	TArray<FInvItem> callItems;
+	callItems.Reserve(call.items.Num());
+	for (const FInventoryTraceSlot& slot : call.items)
+	{
+		callItems.Add(makeItem(slot));
+	}
+	FInvItem firstItem = callItems.Num() > 0 ? callItems[0] : FInvItem();
+
+	uint64 startCycles = FPlatformTime::Cycles64();
+
+	switch (call.op)
+	{
+	case EInventoryTraceOp::AddNewRows:
+		comp->addNewRows(arg(0), arg(1) != 0);
+		break;
+	case EInventoryTraceOp::AddNewItem:
+		comp->addNewItem(firstItem, arg(0) != 0, arg(1) != 0);
+		break;
+	case EInventoryTraceOp::AddItemAtSlot:
+		comp->addItemAtSlot(firstItem, arg(0));
+		break;
+	case EInventoryTraceOp::MoveItem:
+		comp->moveItem(arg(0), arg(1));
+		break;
+	case EInventoryTraceOp::RemoveItem:
+		comp->removeItem(arg(0), arg(1) != 0);
+		break;
+	case EInventoryTraceOp::MoveToNewInvComp:
+		if (other != nullptr)
+		{
+			comp->moveToNewInvComp(arg(0), other);
+		}
+		break;
+	case EInventoryTraceOp::MoveAllToNewInvComp:
+		comp->moveAllToNewInvComp(other);
+		break;
+	case EInventoryTraceOp::ChangeQuantity:
+		comp->changeQuantity(arg(0), arg(1));
+		break;
+	case EInventoryTraceOp::SplitStack:
+		comp->splitStack(arg(0), arg(1));
+		break;
+	case EInventoryTraceOp::CreateLootBag:
+		comp->createLootBag(firstItem, arg(0));
+		break;
+	case EInventoryTraceOp::LoadInventory:
+		comp->loadInventory(MoveTemp(callItems));
+		break;
+	case EInventoryTraceOp::RotateItem:
+		comp->rotateItem(arg(0));
+		break;
+	case EInventoryTraceOp::GetItemQuantity:
+		comp->getItemQuantity(arg(0));
+		break;
+	case EInventoryTraceOp::GetItemAtSlot:
+		comp->getItemAtSlot(arg(0));
+		break;
+	case EInventoryTraceOp::GetRemainingCapacity:
+		comp->getRemainingCapacity(firstItem.item);
+		break;
+	default:
+		break;
+	}
+
+	return FPlatformTime::Cycles64() - startCycles;
+}
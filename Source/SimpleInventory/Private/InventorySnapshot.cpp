@@ -0,0 +1,153 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "InventorySnapshot.h"
+
+FInventorySnapshot::FInventorySnapshot(const TArray<FInvItem>& inventory, const TMap<int, FInvItemTotals>& itemTotals, const TMap<FName, FInvItemTotals>& typeTotals,
+	int inEmptySlots, int64 inTotalValue, uint32 inVersion)
+	: emptySlots(inEmptySlots)
+	, totalValue(inTotalValue)
+	, version(inVersion)
+{
+	slots.Reserve(inventory.Num());
+	for (const FInvItem& curItem : inventory)
+	{
+		FInvSnapshotSlot& newSlot = slots.AddDefaulted_GetRef();
+
+		if (IsValid(curItem.item))
+		{
+			newSlot.uniqueID = curItem.item->uniqueID;
+			newSlot.type = curItem.item->type;
+			newSlot.quantity = curItem.quantity;
+			newSlot.maxStackSize = curItem.item->maxStackSize;
+			newSlot.buyPrice = curItem.item->buyPrice;
+		}
+	}
+
+	itemQuantities.Reserve(itemTotals.Num());
+	for (const TPair<int, FInvItemTotals>& itemTotal : itemTotals)
+	{
+		itemQuantities.Add(itemTotal.Key, itemTotal.Value.quantity);
+	}
+
+	typeQuantities.Reserve(typeTotals.Num());
+	for (const TPair<FName, FInvItemTotals>& typeTotal : typeTotals)
+	{
+		typeQuantities.Add(typeTotal.Key, typeTotal.Value.quantity);
+	}
+}
+
+int FInventorySnapshot::getItemQuantity(int uniqueID) const
+{
+	if (uniqueID == -1)
+	{
+		return emptySlots;
+	}
+
+	const int* quantity = itemQuantities.Find(uniqueID);
+	return quantity ? *quantity : 0;
+}
+
+int FInventorySnapshot::getTypeQuantity(const FName type) const
+{
+	const int* quantity = typeQuantities.Find(type);
+	return quantity ? *quantity : 0;
+}
+
+//Wraps around the end of the inventory and stops once it gets back to startPos, -2 starts from the front
+int FInventorySnapshot::findNextItemOfType(int startPos, int direction, const FName type) const
+{
+	if ((startPos < 0 && startPos != -2) || startPos >= slots.Num() || slots.Num() == 0 || !itemTypeExists(type))
+	{
+		return -1;
+	}
+
+	int step = direction < 0 ? -1 : 1;
+	int curPos = startPos == -2 ? (step > 0 ? slots.Num() - 1 : 0) : startPos;
+
+	for (int i = 0; i < slots.Num(); ++i)
+	{
+		curPos = (curPos + step + slots.Num()) % slots.Num();
+
+		if (slots[curPos].type == type && curPos != startPos)
+		{
+			return curPos;
+		}
+	}
+
+	return -1;
+}
+
+FInventorySnapshotPublisher::~FInventorySnapshotPublisher()
+{
+	if (const FInventorySnapshot* lastSnapshot = current.exchange(nullptr))
+	{
+		lastSnapshot->Release();
+	}
+
+	for (const FInventorySnapshot* oldSnapshot : retired)
+	{
+		oldSnapshot->Release();
+	}
+}
+
+void FInventorySnapshotPublisher::publish(FInventorySnapshot* newSnapshot)
+{
+	//The publisher holds one reference to whatever is current
+	newSnapshot->AddRef();
+	const FInventorySnapshot* oldSnapshot = current.exchange(newSnapshot);
+
+	if (oldSnapshot != nullptr)
+	{
+		FScopeLock lock(&retiredLock);
+		retired.Add(oldSnapshot);
+		retiredCount.fetch_add(1);
+	}
+
+	releaseRetired();
+}
+
+void FInventorySnapshotPublisher::releaseRetired(bool block) const
+{
+	if (retiredCount.load() == 0)
+	{
+		return;
+	}
+
+	if (block)
+	{
+		retiredLock.Lock();
+	}
+	else if (!retiredLock.TryLock())
+	{
+		return;
+	}
+
+	//Anyone who loaded a retired pointer was counted before the swap, so zero here means they all hold their own reference by now
+	if (activeReaders.load() == 0)
+	{
+		for (const FInventorySnapshot* oldSnapshot : retired)
+		{
+			oldSnapshot->Release();
+		}
+
+		retired.Reset();
+		retiredCount.store(0);
+	}
+
+	retiredLock.Unlock();
+}
+
+FInventorySnapshotRef FInventorySnapshotPublisher::acquire() const
+{
+	activeReaders.fetch_add(1);
+	FInventorySnapshotRef snapshot(current.load());
+
+	//Last one out frees whatever a publish had to leave behind, readers never wait on the lock
+	if (activeReaders.fetch_sub(1) == 1)
+	{
+		releaseRetired(false);
+	}
+
+	return snapshot;
+}
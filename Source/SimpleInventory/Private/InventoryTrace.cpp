@@ -0,0 +1,419 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "InventoryTrace.h"
+#include "InventoryComponent.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace InventoryTrace
+{
+	static constexpr uint32 magic = 0x52544953; //SITR
+	static constexpr uint32 version = 1;
+	//Buffered records are written out once they pass this
+	static constexpr int32 flushSize = 64 * 1024;
+
+	enum class ERecord : uint8
+	{
+		Item,
+		Component,
+		Call
+	};
+
+	static void serializeSlot(FArchive& ar, FInventoryTraceSlot& slot)
+	{
+		uint32 quantity = static_cast<uint32>(FMath::Max(slot.quantity, 0));
+		uint8 rotated = slot.rotated ? 1 : 0;
+		ar << slot.itemId;
+		ar.SerializeIntPacked(quantity);
+		ar << rotated;
+		slot.quantity = static_cast<int32>(quantity);
+		slot.rotated = rotated != 0;
+	}
+
+	static void serializeSlots(FArchive& ar, TArray<FInventoryTraceSlot>& slots)
+	{
+		uint32 count = slots.Num();
+		ar.SerializeIntPacked(count);
+		if (ar.IsLoading())
+		{
+			slots.SetNum(count);
+		}
+
+		for (FInventoryTraceSlot& slot : slots)
+		{
+			serializeSlot(ar, slot);
+		}
+	}
+
+	static void serializeComponent(FArchive& ar, FInventoryTraceComponent& comp)
+	{
+		uint32 rows = comp.rows;
+		uint32 maxRows = comp.maxRows;
+		uint32 slotsPerRow = comp.slotsPerRow;
+		uint8 flags = (comp.useShapedItems ? 1 : 0) | (comp.allowRotation ? 2 : 0) | (comp.useBestFit ? 4 : 0);
+
+		ar << comp.name;
+		ar.SerializeIntPacked(rows);
+		ar.SerializeIntPacked(maxRows);
+		ar.SerializeIntPacked(slotsPerRow);
+		ar << flags;
+		ar << comp.mergeDist;
+		ar << comp.lootBagClass;
+		ar << comp.location;
+		serializeSlots(ar, comp.slots);
+
+		comp.rows = rows;
+		comp.maxRows = maxRows;
+		comp.slotsPerRow = slotsPerRow;
+		comp.useShapedItems = (flags & 1) != 0;
+		comp.allowRotation = (flags & 2) != 0;
+		comp.useBestFit = (flags & 4) != 0;
+	}
+
+	//Component indices are stored one higher so INDEX_NONE packs as 0
+	static void serializeIndex(FArchive& ar, int32& index)
+	{
+		uint32 packed = index + 1;
+		ar.SerializeIntPacked(packed);
+		index = static_cast<int32>(packed) - 1;
+	}
+
+	static FInventoryTraceSlot makeSlot(const FInvItem& item)
+	{
+		FInventoryTraceSlot slot;
+		if (IsValid(item.item))
+		{
+			slot.itemId = item.item->uniqueID;
+			slot.quantity = item.quantity;
+			slot.rotated = item.rotated != 0;
+		}
+		return slot;
+	}
+
+	static FAutoConsoleCommand startCommand(
+		TEXT("SimpleInventory.Trace.Start"),
+		TEXT("Start recording inventory calls to a trace file, takes an optional file name under Saved/InventoryTraces."),
+		FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& args)
+		{
+			FString fileName = args.Num() > 0 ? args[0] : FString::Printf(TEXT("trace_%s.bin"), *FDateTime::Now().ToString());
+			FString path = FPaths::IsRelative(fileName) ? FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("InventoryTraces"), fileName) : fileName;
+			FInventoryTraceRecorder::get().start(path);
+		}));
+
+	static FAutoConsoleCommand stopCommand(
+		TEXT("SimpleInventory.Trace.Stop"),
+		TEXT("Stop recording inventory calls and close the trace file."),
+		FConsoleCommandDelegate::CreateLambda([]()
+		{
+			FInventoryTraceRecorder::get().stop();
+		}));
+}
+
+using namespace InventoryTrace;
+
+bool FInventoryTrace::load(const FString& path, FInventoryTrace& outTrace)
+{
+	TArray<uint8> bytes;
+	if (!FFileHelper::LoadFileToArray(bytes, *path))
+	{
+		return false;
+	}
+
+	FMemoryReader ar(bytes);
+	uint32 fileMagic = 0;
+	uint32 fileVersion = 0;
+	ar << fileMagic << fileVersion;
+
+	if (fileMagic != magic || fileVersion != version)
+	{
+		return false;
+	}
+
+	ar << outTrace.secondsPerCycle;
+	uint64 timestamp = 0;
+
+	//A trace cut off mid record by a crash still replays up to the last whole one
+	while (!ar.AtEnd() && !ar.IsError())
+	{
+		uint8 tag = 0;
+		ar << tag;
+
+		if (tag == static_cast<uint8>(ERecord::Item))
+		{
+			int32 id = -1;
+			FString itemPath;
+			ar << id << itemPath;
+			if (!ar.IsError())
+			{
+				outTrace.itemPaths.Add(id, MoveTemp(itemPath));
+			}
+		}
+		else if (tag == static_cast<uint8>(ERecord::Component))
+		{
+			FInventoryTraceComponent comp;
+			serializeComponent(ar, comp);
+			if (!ar.IsError())
+			{
+				outTrace.components.Add(MoveTemp(comp));
+			}
+		}
+		else if (tag == static_cast<uint8>(ERecord::Call))
+		{
+			FInventoryTraceCall call;
+			uint8 op = 0;
+			uint64 delta = 0;
+			uint8 argCount = 0;
+
+			ar << op;
+			serializeIndex(ar, call.component);
+			serializeIndex(ar, call.otherComponent);
+			ar.SerializeIntPacked64(delta);
+			ar.SerializeIntPacked64(call.durationCycles);
+			ar << argCount;
+			call.args.SetNum(argCount);
+			for (int32& arg : call.args)
+			{
+				ar << arg;
+			}
+			serializeSlots(ar, call.items);
+			ar << call.stateHash;
+
+			if (ar.IsError() || op >= static_cast<uint8>(EInventoryTraceOp::Count))
+			{
+				break;
+			}
+
+			timestamp += delta;
+			call.op = static_cast<EInventoryTraceOp>(op);
+			call.timestamp = timestamp;
+			outTrace.calls.Add(MoveTemp(call));
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	return true;
+}
+
+const TCHAR* FInventoryTrace::getOpName(EInventoryTraceOp op)
+{
+	switch (op)
+	{
+	case EInventoryTraceOp::AddNewRows: return TEXT("addNewRows");
+	case EInventoryTraceOp::AddNewItem: return TEXT("addNewItem");
+	case EInventoryTraceOp::AddItemAtSlot: return TEXT("addItemAtSlot");
+	case EInventoryTraceOp::MoveItem: return TEXT("moveItem");
+	case EInventoryTraceOp::RemoveItem: return TEXT("removeItem");
+	case EInventoryTraceOp::MoveToNewInvComp: return TEXT("moveToNewInvComp");
+	case EInventoryTraceOp::MoveAllToNewInvComp: return TEXT("moveAllToNewInvComp");
+	case EInventoryTraceOp::ChangeQuantity: return TEXT("changeQuantity");
+	case EInventoryTraceOp::SplitStack: return TEXT("splitStack");
+	case EInventoryTraceOp::CreateLootBag: return TEXT("createLootBag");
+	case EInventoryTraceOp::LoadInventory: return TEXT("loadInventory");
+	case EInventoryTraceOp::RotateItem: return TEXT("rotateItem");
+	case EInventoryTraceOp::GetItemQuantity: return TEXT("getItemQuantity");
+	case EInventoryTraceOp::GetItemAtSlot: return TEXT("getItemAtSlot");
+	case EInventoryTraceOp::GetRemainingCapacity: return TEXT("getRemainingCapacity");
+	default: return TEXT("unknown");
+	}
+}
+
+FInventoryTraceRecorder& FInventoryTraceRecorder::get()
+{
+	static FInventoryTraceRecorder recorder;
+	return recorder;
+}
+
+bool FInventoryTraceRecorder::start(const FString& path)
+{
+	check(IsInGameThread());
+	stop();
+
+	file.Reset(IFileManager::Get().CreateFileWriter(*path));
+	if (!file.IsValid())
+	{
+		return false;
+	}
+
+	uint32 fileMagic = magic;
+	uint32 fileVersion = version;
+	double secondsPerCycle = FPlatformTime::GetSecondsPerCycle64();
+	*file << fileMagic << fileVersion << secondsPerCycle;
+
+	startCycles = FPlatformTime::Cycles64();
+	lastTimestamp = 0;
+	return true;
+}
+
+void FInventoryTraceRecorder::stop()
+{
+	if (!file.IsValid())
+	{
+		return;
+	}
+
+	flushBuffer();
+	file->Close();
+	file.Reset();
+
+	componentIndices.Empty();
+	writtenItems.Empty();
+}
+
+uint64 FInventoryTraceRecorder::getTimestamp() const
+{
+	return static_cast<uint64>(FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - startCycles) * 1000.0);
+}
+
+int32 FInventoryTraceRecorder::getComponentIndex(const UInventoryComponent* comp) const
+{
+	const int32* index = comp ? componentIndices.Find(comp) : nullptr;
+	return index ? *index : INDEX_NONE;
+}
+
+void FInventoryTraceRecorder::internItem(const UItemAsset* itemAsset)
+{
+	if (!IsValid(itemAsset) || writtenItems.Contains(itemAsset->uniqueID))
+	{
+		return;
+	}
+
+	writtenItems.Add(itemAsset->uniqueID);
+
+	FMemoryWriter ar(buffer, false, true);
+	uint8 tag = static_cast<uint8>(ERecord::Item);
+	int32 id = itemAsset->uniqueID;
+	FString itemPath = itemAsset->GetPathName();
+	ar << tag << id << itemPath;
+}
+
+void FInventoryTraceRecorder::internComponent(UInventoryComponent* comp)
+{
+	if (!IsValid(comp) || componentIndices.Contains(comp))
+	{
+		return;
+	}
+
+	FInventoryTraceComponent traced;
+	traced.name = comp->GetPathName();
+	traced.rows = comp->getRows();
+	traced.maxRows = comp->maxInventoryRows;
+	traced.slotsPerRow = comp->slotsPerRow;
+	traced.useShapedItems = comp->useShapedItems;
+	traced.allowRotation = comp->allowRotation;
+	traced.useBestFit = comp->useBestFit;
+	traced.mergeDist = comp->mergeDist;
+	traced.lootBagClass = comp->lootBag ? comp->lootBag->GetPathName() : FString();
+	traced.location = comp->GetOwner() ? comp->GetOwner()->GetActorLocation() : FVector::ZeroVector;
+
+	traced.slots.Reserve(comp->inventoryArray.Num());
+	for (int i = 0; i < comp->inventoryArray.Num(); ++i)
+	{
+		const FInvItem& slotItem = comp->inventoryArray[i];
+		internItem(slotItem.item);
+		traced.slots.Add(makeSlot(slotItem));
+	}
+
+	componentIndices.Add(comp, componentIndices.Num());
+
+	FMemoryWriter ar(buffer, false, true);
+	uint8 tag = static_cast<uint8>(ERecord::Component);
+	ar << tag;
+	serializeComponent(ar, traced);
+}
+
+void FInventoryTraceRecorder::recordCall(const FInventoryTraceCall& call)
+{
+	FInventoryTraceCall written = call;
+	uint8 tag = static_cast<uint8>(ERecord::Call);
+	uint8 op = static_cast<uint8>(written.op);
+	uint64 delta = written.timestamp - FMath::Min(lastTimestamp, written.timestamp);
+	uint8 argCount = static_cast<uint8>(FMath::Min(written.args.Num(), 255));
+	lastTimestamp = FMath::Max(lastTimestamp, written.timestamp);
+
+	FMemoryWriter ar(buffer, false, true);
+	ar << tag << op;
+	serializeIndex(ar, written.component);
+	serializeIndex(ar, written.otherComponent);
+	ar.SerializeIntPacked64(delta);
+	ar.SerializeIntPacked64(written.durationCycles);
+	ar << argCount;
+	for (int i = 0; i < argCount; ++i)
+	{
+		ar << written.args[i];
+	}
+	serializeSlots(ar, written.items);
+	ar << written.stateHash;
+
+	if (buffer.Num() >= flushSize)
+	{
+		flushBuffer();
+	}
+}
+
+void FInventoryTraceRecorder::flushBuffer()
+{
+	if (file.IsValid() && buffer.Num() > 0)
+	{
+		file->Serialize(buffer.GetData(), buffer.Num());
+		file->Flush();
+	}
+
+	buffer.Reset();
+}
+
+FInventoryTraceScope::FInventoryTraceScope(UInventoryComponent* comp, EInventoryTraceOp op, TArrayView<const int32> args, TArrayView<const FInvItem> items, UInventoryComponent* other)
+{
+	FInventoryTraceRecorder& recorder = FInventoryTraceRecorder::get();
+	recording = recorder.enterCall() && IsValid(comp);
+
+	if (!recording)
+	{
+		return;
+	}
+
+	//Both inventories are written as they were before the call so replay starts from the same place
+	recorder.internComponent(comp);
+	recorder.internComponent(other);
+
+	target = comp;
+	call.op = op;
+	call.component = recorder.getComponentIndex(comp);
+	call.otherComponent = recorder.getComponentIndex(other);
+	call.args.Append(args.GetData(), args.Num());
+	call.items.Reserve(items.Num());
+	for (const FInvItem& item : items)
+	{
+		recorder.internItem(item.item);
+		call.items.Add(makeSlot(item));
+	}
+
+	call.timestamp = recorder.getTimestamp();
+	startCycles = FPlatformTime::Cycles64();
+}
+
+FInventoryTraceScope::~FInventoryTraceScope()
+{
+	FInventoryTraceRecorder& recorder = FInventoryTraceRecorder::get();
+
+	if (recording)
+	{
+		call.durationCycles = FPlatformTime::Cycles64() - startCycles;
+
+		//The call may have stopped the recording or destroyed its own component
+		if (recorder.isRecording() && IsValid(target))
+		{
+			call.stateHash = target->getStateHash();
+			recorder.recordCall(call);
+		}
+	}
+
+	recorder.leaveCall();
+}
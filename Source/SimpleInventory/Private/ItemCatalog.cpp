@@ -0,0 +1,196 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ItemCatalog.h"
+#include "InventoryItem.h"
+#include "Algo/BinarySearch.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+//A dense index is only written when the IDs are packed tightly enough that it stays small next to the records
+static constexpr uint32 maxDenseSpread = 4;
+
+FItemCatalog::~FItemCatalog()
+{
+	reset();
+}
+
+FItemCatalog& FItemCatalog::get()
+{
+	static FItemCatalog catalog;
+	return catalog;
+}
+
+FString FItemCatalog::getDefaultPath()
+{
+	return FPaths::Combine(FPaths::ProjectContentDir(), TEXT("SimpleInventory"), TEXT("ItemCatalog.bin"));
+}
+
+bool FItemCatalog::load(const FString& path)
+{
+	reset();
+
+	//Mapping only works for loose files, anything inside a pak falls back to a single read
+	mappedFile.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*path));
+	if (mappedFile.IsValid() && mappedFile->GetFileSize() > 0)
+	{
+		mappedRegion.Reset(mappedFile->MapRegion(0, mappedFile->GetFileSize()));
+		if (mappedRegion.IsValid() && parse(mappedRegion->GetMappedPtr(), mappedRegion->GetMappedSize()))
+		{
+			return true;
+		}
+	}
+
+	reset();
+
+	if (!FFileHelper::LoadFileToArray(fileBytes, *path, FILEREAD_Silent) || !parse(fileBytes.GetData(), fileBytes.Num()))
+	{
+		reset();
+		return false;
+	}
+
+	return true;
+}
+
+void FItemCatalog::reset()
+{
+	header = nullptr;
+	records = nullptr;
+	denseIndex = nullptr;
+	typeNames.Empty();
+
+	mappedRegion.Reset();
+	mappedFile.Reset();
+	fileBytes.Empty();
+}
+
+bool FItemCatalog::parse(const uint8* data, int64 size)
+{
+	if (data == nullptr || size < static_cast<int64>(sizeof(FItemCatalogHeader)))
+	{
+		return false;
+	}
+
+	const FItemCatalogHeader* fileHeader = reinterpret_cast<const FItemCatalogHeader*>(data);
+	if (fileHeader->magic != magic || fileHeader->version != version)
+	{
+		return false;
+	}
+
+	int64 recordsOffset = sizeof(FItemCatalogHeader);
+	int64 denseOffset = recordsOffset + static_cast<int64>(fileHeader->recordCount) * sizeof(FItemCatalogRecord);
+	int64 typeOffsetsOffset = denseOffset + static_cast<int64>(fileHeader->denseCount) * sizeof(uint32);
+	int64 namesOffset = typeOffsetsOffset + static_cast<int64>(fileHeader->typeCount) * sizeof(uint32);
+
+	if (namesOffset + fileHeader->typeNameBytes > size)
+	{
+		return false;
+	}
+
+	//find indexes the dense table straight by ID, so it has to cover exactly [minID, maxID]
+	if (fileHeader->denseCount > 0 && static_cast<int64>(fileHeader->denseCount) != static_cast<int64>(fileHeader->maxID) - fileHeader->minID + 1)
+	{
+		return false;
+	}
+
+	const uint32* typeOffsets = reinterpret_cast<const uint32*>(data + typeOffsetsOffset);
+	const ANSICHAR* names = reinterpret_cast<const ANSICHAR*>(data + namesOffset);
+
+	//Type names are the only part turned into engine types, there are only a handful of them
+	typeNames.Reserve(fileHeader->typeCount);
+	for (uint32 i = 0; i < fileHeader->typeCount; ++i)
+	{
+		uint32 start = typeOffsets[i];
+		uint32 end = i + 1 < fileHeader->typeCount ? typeOffsets[i + 1] : fileHeader->typeNameBytes;
+		if (start > end || end > fileHeader->typeNameBytes)
+		{
+			typeNames.Empty();
+			return false;
+		}
+
+		//Converted with a length, so the result isn't null terminated
+		FUTF8ToTCHAR typeName(names + start, end - start);
+		typeNames.Add(FName(FString(typeName.Length(), typeName.Get())));
+	}
+
+	header = fileHeader;
+	records = reinterpret_cast<const FItemCatalogRecord*>(data + recordsOffset);
+	denseIndex = fileHeader->denseCount > 0 ? reinterpret_cast<const uint32*>(data + denseOffset) : nullptr;
+	return true;
+}
+
+const FItemCatalogRecord* FItemCatalog::find(int32 uniqueID) const
+{
+	if (header == nullptr || header->recordCount == 0 || uniqueID < header->minID || uniqueID > header->maxID)
+	{
+		return nullptr;
+	}
+
+	if (denseIndex != nullptr)
+	{
+		//A bad entry in a corrupt file reads as missing rather than past the records
+		uint32 recordIndex = denseIndex[static_cast<int64>(uniqueID) - header->minID];
+		return recordIndex > 0 && recordIndex <= header->recordCount ? &records[recordIndex - 1] : nullptr;
+	}
+
+	int32 found = Algo::BinarySearchBy(TArrayView<const FItemCatalogRecord>(records, header->recordCount), uniqueID, &FItemCatalogRecord::uniqueID);
+	return found != INDEX_NONE ? &records[found] : nullptr;
+}
+
+int32 FItemCatalog::getMaxStackSize(const UItemAsset* itemAsset)
+{
+	const FItemCatalogRecord* record = get().find(itemAsset->uniqueID);
+	return record ? record->maxStackSize : itemAsset->maxStackSize;
+}
+
+int32 FItemCatalog::getBuyPrice(const UItemAsset* itemAsset)
+{
+	const FItemCatalogRecord* record = get().find(itemAsset->uniqueID);
+	return record ? record->buyPrice : itemAsset->buyPrice;
+}
+
+void FItemCatalog::write(TArrayView<const FItemCatalogRecord> sortedRecords, TArrayView<const FName> types, TArray<uint8>& outBytes)
+{
+	FItemCatalogHeader fileHeader;
+	fileHeader.magic = magic;
+	fileHeader.version = version;
+	fileHeader.recordCount = sortedRecords.Num();
+	fileHeader.typeCount = types.Num();
+
+	TArray<uint32> dense;
+	if (sortedRecords.Num() > 0)
+	{
+		fileHeader.minID = sortedRecords[0].uniqueID;
+		fileHeader.maxID = sortedRecords.Last().uniqueID;
+
+		int64 spread = static_cast<int64>(fileHeader.maxID) - fileHeader.minID + 1;
+		if (spread <= static_cast<int64>(sortedRecords.Num()) * maxDenseSpread)
+		{
+			dense.SetNumZeroed(spread);
+			for (int32 i = 0; i < sortedRecords.Num(); ++i)
+			{
+				dense[sortedRecords[i].uniqueID - fileHeader.minID] = i + 1;
+			}
+		}
+	}
+	fileHeader.denseCount = dense.Num();
+
+	TArray<uint32> typeOffsets;
+	TArray<uint8> names;
+	for (const FName& type : types)
+	{
+		typeOffsets.Add(names.Num());
+		FTCHARToUTF8 utf8(*type.ToString());
+		names.Append(reinterpret_cast<const uint8*>(utf8.Get()), utf8.Length());
+	}
+	fileHeader.typeNameBytes = names.Num();
+
+	outBytes.Reset();
+	outBytes.Append(reinterpret_cast<const uint8*>(&fileHeader), sizeof(fileHeader));
+	outBytes.Append(reinterpret_cast<const uint8*>(sortedRecords.GetData()), sortedRecords.Num() * sizeof(FItemCatalogRecord));
+	outBytes.Append(reinterpret_cast<const uint8*>(dense.GetData()), dense.Num() * sizeof(uint32));
+	outBytes.Append(reinterpret_cast<const uint8*>(typeOffsets.GetData()), typeOffsets.Num() * sizeof(uint32));
+	outBytes.Append(names);
+}
@@ -0,0 +1,129 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ItemCatalogCommandlet.h"
+#include "ItemCatalog.h"
+#include "InventoryItem.h"
+#include "AssetRegistry/AssetRegistryModule.h"
+#include "Misc/FileHelper.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogItemCatalog, Log, All);
+
+UItemCatalogCommandlet::UItemCatalogCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+}
+
+int32 UItemCatalogCommandlet::Main(const FString& Params)
+{
+	FString outputPath = FItemCatalog::getDefaultPath();
+	FParse::Value(*Params, TEXT("Output="), outputPath);
+
+	return buildCatalog(outputPath) ? 0 : 1;
+}
+
+bool UItemCatalogCommandlet::buildCatalog(const FString& outputPath)
+{
+	IAssetRegistry& assetRegistry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>("AssetRegistry").Get();
+	assetRegistry.SearchAllAssets(true);
+
+	TArray<FAssetData> itemAssets;
+	assetRegistry.GetAssetsByClass(UItemAsset::StaticClass()->GetClassPathName(), itemAssets, true);
+
+	TArray<FItemCatalogRecord> records;
+	TMap<int32, FString> seenIDs;
+	TMap<int32, FName> recordTypes;
+	int32 duplicates = 0;
+
+	for (const FAssetData& assetData : itemAssets)
+	{
+		const UItemAsset* itemAsset = Cast<UItemAsset>(assetData.GetAsset());
+		if (itemAsset == nullptr)
+		{
+			UE_LOG(LogItemCatalog, Warning, TEXT("Could not load %s, it is left out of the catalog"), *assetData.GetObjectPathString());
+			continue;
+		}
+
+		FString path = itemAsset->GetPathName();
+		if (const FString* firstPath = seenIDs.Find(itemAsset->uniqueID))
+		{
+			UE_LOG(LogItemCatalog, Error, TEXT("uniqueID %d is used by both %s and %s"), itemAsset->uniqueID, **firstPath, *path);
+			++duplicates;
+			continue;
+		}
+		seenIDs.Add(itemAsset->uniqueID, path);
+
+		if (itemAsset->maxStackSize <= 0)
+		{
+			UE_LOG(LogItemCatalog, Warning, TEXT("%s has a max stack size of %d, it can never be added to an inventory"), *path, itemAsset->maxStackSize);
+		}
+
+		recordTypes.Add(itemAsset->uniqueID, itemAsset->type);
+		FIntPoint footprint = itemAsset->getFootprint();
+
+		FItemCatalogRecord& record = records.AddDefaulted_GetRef();
+		record.uniqueID = itemAsset->uniqueID;
+		record.maxStackSize = itemAsset->maxStackSize;
+		record.buyPrice = itemAsset->buyPrice;
+		record.footprintX = static_cast<uint8>(FMath::Min(footprint.X, static_cast<int32>(MAX_uint8)));
+		record.footprintY = static_cast<uint8>(FMath::Min(footprint.Y, static_cast<int32>(MAX_uint8)));
+	}
+
+	if (duplicates > 0)
+	{
+		UE_LOG(LogItemCatalog, Error, TEXT("%d item(s) share a uniqueID with another item, the catalog was not written"), duplicates);
+		return false;
+	}
+
+	records.Sort([](const FItemCatalogRecord& a, const FItemCatalogRecord& b) { return a.uniqueID < b.uniqueID; });
+
+	//Types are numbered in ID order so the same items always give the same file
+	TArray<FName> types;
+	TMap<FName, uint16> typeIndices;
+	for (FItemCatalogRecord& record : records)
+	{
+		FName type = recordTypes[record.uniqueID];
+		uint16* typeIndex = typeIndices.Find(type);
+
+		if (typeIndex == nullptr)
+		{
+			if (types.Num() > MAX_uint16)
+			{
+				UE_LOG(LogItemCatalog, Error, TEXT("Too many item types for the catalog"));
+				return false;
+			}
+
+			typeIndex = &typeIndices.Add(type, static_cast<uint16>(types.Num()));
+			types.Add(type);
+		}
+
+		record.typeIndex = *typeIndex;
+	}
+
+	TArray<uint8> catalogBytes;
+	FItemCatalog::write(records, types, catalogBytes);
+
+	//This process may have the old file mapped, which on Windows stops it being overwritten
+	FItemCatalog& loadedCatalog = FItemCatalog::get();
+	bool wasLoaded = loadedCatalog.isLoaded();
+	loadedCatalog.reset();
+
+	bool saved = FFileHelper::SaveArrayToFile(catalogBytes, *outputPath);
+
+	if (wasLoaded)
+	{
+		loadedCatalog.load(FItemCatalog::getDefaultPath());
+	}
+
+	if (!saved)
+	{
+		UE_LOG(LogItemCatalog, Error, TEXT("Could not write the item catalog to %s"), *outputPath);
+		return false;
+	}
+
+	UE_LOG(LogItemCatalog, Display, TEXT("Wrote %d items and %d types to %s (%d bytes)"), records.Num(), types.Num(), *outputPath, catalogBytes.Num());
+	return true;
+}
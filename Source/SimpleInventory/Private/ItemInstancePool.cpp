@@ -0,0 +1,107 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ItemInstancePool.h"
+#include <atomic>
+
+FItemInstancePool::FItemInstancePool()
+{
+	//Tags fit under the sign bit so handles are always positive, 0 is skipped so no pool uses it
+	static std::atomic<uint32> nextPoolTag{ 0 };
+	poolTag = static_cast<int32>(nextPoolTag.fetch_add(1) % maxPoolTag) + 1;
+}
+
+int32 FItemInstancePool::allocate(FItemInstanceData&& data)
+{
+	int32 index = freeHead;
+
+	if (index != INDEX_NONE)
+	{
+		freeHead = entries[index].nextFree;
+	}
+	else
+	{
+		if (entries.Num() > indexMask)
+		{
+			return 0;
+		}
+
+		index = entries.AddDefaulted();
+	}
+
+	FEntry& entry = entries[index];
+	entry.data = MoveTemp(data);
+	entry.nextFree = INDEX_NONE;
+	entry.inUse = true;
+	++liveCount;
+
+	return (poolTag << tagShift) | (entry.generation << indexBits) | index;
+}
+
+void FItemInstancePool::release(int32 handle)
+{
+	int32 index = getEntryIndex(handle);
+	if (index == INDEX_NONE)
+	{
+		return;
+	}
+
+	FEntry& entry = entries[index];
+	entry.data = FItemInstanceData();
+	entry.inUse = false;
+	//Generation 0 is skipped so a live handle is never 0
+	entry.generation = entry.generation >= maxGeneration ? 1 : entry.generation + 1;
+	entry.nextFree = freeHead;
+	freeHead = index;
+	--liveCount;
+}
+
+bool FItemInstancePool::take(int32 handle, FItemInstanceData& outData)
+{
+	int32 index = getEntryIndex(handle);
+	if (index == INDEX_NONE)
+	{
+		return false;
+	}
+
+	outData = MoveTemp(entries[index].data);
+	release(handle);
+	return true;
+}
+
+FItemInstanceData* FItemInstancePool::find(int32 handle)
+{
+	int32 index = getEntryIndex(handle);
+	return index != INDEX_NONE ? &entries[index].data : nullptr;
+}
+
+const FItemInstanceData* FItemInstancePool::find(int32 handle) const
+{
+	int32 index = getEntryIndex(handle);
+	return index != INDEX_NONE ? &entries[index].data : nullptr;
+}
+
+void FItemInstancePool::reset()
+{
+	entries.Reset();
+	freeHead = INDEX_NONE;
+	liveCount = 0;
+}
+
+int32 FItemInstancePool::getEntryIndex(int32 handle) const
+{
+	if (handle <= 0 || (handle >> tagShift) != poolTag)
+	{
+		return INDEX_NONE;
+	}
+
+	int32 index = handle & indexMask;
+	int32 generation = (handle >> indexBits) & maxGeneration;
+
+	if (!entries.IsValidIndex(index) || !entries[index].inUse || entries[index].generation != generation)
+	{
+		return INDEX_NONE;
+	}
+
+	return index;
+}
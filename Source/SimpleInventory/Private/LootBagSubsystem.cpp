@@ -0,0 +1,362 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LootBagSubsystem.h"
+#include "InventoryComponent.h"
+#include "HAL/IConsoleManager.h"
+#include "Kismet/GameplayStatics.h"
+
+static TAutoConsoleVariable<float> CVarLootBagMergeInterval(
+	TEXT("SimpleInventory.LootBagMergeInterval"),
+	10.0f,
+	TEXT("Seconds between loot bag merge passes, 0 or less turns them off."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarLootBagMergeCellSize(
+	TEXT("SimpleInventory.LootBagMergeCellSize"),
+	500.0f,
+	TEXT("Size of the grid cells loot bags are grouped into, keep it around the merge distance so each bag only has to look at the cells next to its own."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarLootBagMergeDistance(
+	TEXT("SimpleInventory.LootBagMergeDistance"),
+	500.0f,
+	TEXT("Loot bags closer than this get merged, even when they fall in different cells."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarLootBagBagsPerFrame(
+	TEXT("SimpleInventory.LootBagBagsPerFrame"),
+	32,
+	TEXT("Loot bags a merge pass looks at per frame."),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarLootBagMaxPooled(
+	TEXT("SimpleInventory.LootBagMaxPooled"),
+	16,
+	TEXT("Emptied loot bags kept around for reuse, extras are destroyed."),
+	ECVF_Default);
+
+bool ULootBagSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	if (!Super::ShouldCreateSubsystem(Outer))
+	{
+		return false;
+	}
+
+	UWorld* world = Cast<UWorld>(Outer);
+	return world != nullptr && world->IsGameWorld();
+}
+
+TStatId ULootBagSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(ULootBagSubsystem, STATGROUP_Tickables);
+}
+
+void ULootBagSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	//Clients see the results through replication, only the authority merges
+	UWorld* world = GetWorld();
+	if (world == nullptr || world->GetNetMode() == NM_Client)
+	{
+		return;
+	}
+
+	int budget = FMath::Max(CVarLootBagBagsPerFrame.GetValueOnGameThread(), 1);
+
+	switch (phase)
+	{
+	case EPassPhase::Idle:
+	{
+		float interval = CVarLootBagMergeInterval.GetValueOnGameThread();
+		timeSinceLastPass += DeltaTime;
+
+		if (interval > 0 && timeSinceLastPass >= interval)
+		{
+			startPass();
+		}
+		break;
+	}
+	case EPassPhase::Bucket:
+		bucketBags(budget);
+		break;
+	case EPassPhase::Merge:
+		mergeCells(budget);
+		break;
+	}
+}
+
+void ULootBagSubsystem::requestPass()
+{
+	if (phase == EPassPhase::Idle)
+	{
+		startPass();
+	}
+}
+
+void ULootBagSubsystem::startPass()
+{
+	timeSinceLastPass = 0;
+	passBags.Reset();
+	cells.Reset();
+	cellKeys.Reset();
+	nextBag = 0;
+	nextCell = 0;
+	mergedThisPass = 0;
+
+	for (const TSubclassOf<AActor>& bagClass : bagClasses)
+	{
+		TArray<AActor*> foundBags;
+		UGameplayStatics::GetAllActorsOfClass(GetWorld(), bagClass, foundBags);
+
+		for (AActor* bag : foundBags)
+		{
+			if (!isPooled(bag))
+			{
+				passBags.Add(bag);
+			}
+		}
+	}
+
+	stats.bagsInWorld = passBags.Num();
+	phase = EPassPhase::Bucket;
+}
+
+void ULootBagSubsystem::bucketBags(int budget)
+{
+	float cellSize = FMath::Max(CVarLootBagMergeCellSize.GetValueOnGameThread(), 1.0f);
+	int end = FMath::Min(nextBag + budget, passBags.Num());
+
+	for (; nextBag < end; ++nextBag)
+	{
+		AActor* bag = passBags[nextBag].Get();
+		if (!IsValid(bag))
+		{
+			continue;
+		}
+
+		FVector location = bag->GetActorLocation() / cellSize;
+		FIntVector cell(FMath::FloorToInt(location.X), FMath::FloorToInt(location.Y), FMath::FloorToInt(location.Z));
+
+		TArray<TWeakObjectPtr<AActor>>& cellBags = cells.FindOrAdd(cell);
+		if (cellBags.Num() == 0)
+		{
+			cellKeys.Add(cell);
+		}
+		cellBags.Add(bag);
+	}
+
+	if (nextBag >= passBags.Num())
+	{
+		passBags.Reset();
+		phase = EPassPhase::Merge;
+	}
+}
+
+void ULootBagSubsystem::mergeCells(int budget)
+{
+	int bagsLooked = 0;
+
+	while (nextCell < cellKeys.Num() && bagsLooked < budget)
+	{
+		bagsLooked += cells[cellKeys[nextCell]].Num();
+		mergedThisPass += mergeCell(cellKeys[nextCell]);
+		++nextCell;
+	}
+
+	if (nextCell >= cellKeys.Num())
+	{
+		cells.Reset();
+		cellKeys.Reset();
+		phase = EPassPhase::Idle;
+
+		stats.bagsMergedLastPass = mergedThisPass;
+		stats.bagsMergedTotal += mergedThisPass;
+		++stats.passesCompleted;
+	}
+}
+
+//Bags in the cell give their items to the fullest bags within the merge distance, those can be in the cells around it
+//Bags only take from bags at most as full as they are, and a bag that gets emptied is pooled, so nothing moves back and forth
+int ULootBagSubsystem::mergeCell(const FIntVector& cell)
+{
+	float cellSize = FMath::Max(CVarLootBagMergeCellSize.GetValueOnGameThread(), 1.0f);
+	float mergeDist = FMath::Max(CVarLootBagMergeDistance.GetValueOnGameThread(), 0.0f);
+	int range = FMath::CeilToInt(mergeDist / cellSize);
+
+	TArray<TPair<AActor*, UInventoryComponent*>> sources;
+	TArray<TPair<AActor*, UInventoryComponent*>> targets;
+
+	for (int x = -range; x <= range; ++x)
+	{
+		for (int y = -range; y <= range; ++y)
+		{
+			for (int z = -range; z <= range; ++z)
+			{
+				const TArray<TWeakObjectPtr<AActor>>* cellBags = cells.Find(cell + FIntVector(x, y, z));
+				if (cellBags == nullptr)
+				{
+					continue;
+				}
+
+				for (const TWeakObjectPtr<AActor>& bag : *cellBags)
+				{
+					UInventoryComponent* bagInv = getBagInventory(bag.Get());
+					if (bagInv != nullptr && !isPooled(bag.Get()))
+					{
+						targets.Emplace(bag.Get(), bagInv);
+
+						if (x == 0 && y == 0 && z == 0)
+						{
+							sources.Emplace(bag.Get(), bagInv);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	//Emptiest bags give first, fullest bags take first
+	sources.Sort([](const TPair<AActor*, UInventoryComponent*>& a, const TPair<AActor*, UInventoryComponent*>& b)
+	{
+		return a.Value->getAmountOfEmptySlots() > b.Value->getAmountOfEmptySlots();
+	});
+	targets.Sort([](const TPair<AActor*, UInventoryComponent*>& a, const TPair<AActor*, UInventoryComponent*>& b)
+	{
+		return a.Value->getAmountOfEmptySlots() < b.Value->getAmountOfEmptySlots();
+	});
+
+	int emptied = 0;
+	for (const TPair<AActor*, UInventoryComponent*>& source : sources)
+	{
+		UInventoryComponent* sourceInv = source.Value;
+		if (isPooled(source.Key))
+		{
+			continue;
+		}
+
+		//Already looted, nothing to give away but it still goes back to the pool
+		if (sourceInv->isEmpty())
+		{
+			releaseLootBag(source.Key);
+			++emptied;
+			continue;
+		}
+
+		FVector sourceLoc = source.Key->GetActorLocation();
+
+		for (const TPair<AActor*, UInventoryComponent*>& target : targets)
+		{
+			//Bags of different classes can have different sized inventories so they only merge with their own kind
+			if (target.Key == source.Key || target.Key->GetClass() != source.Key->GetClass() || isPooled(target.Key)
+				|| FVector::Distance(sourceLoc, target.Key->GetActorLocation()) > mergeDist)
+			{
+				continue;
+			}
+
+			if (target.Value->getAmountOfEmptySlots() > sourceInv->getAmountOfEmptySlots())
+			{
+				continue;
+			}
+
+			//False means the target filled up before the source emptied, try the next one
+			if (sourceInv->moveAllToNewInvComp(target.Value))
+			{
+				break;
+			}
+		}
+
+		if (sourceInv->isEmpty())
+		{
+			releaseLootBag(source.Key);
+			++emptied;
+		}
+	}
+
+	return emptied;
+}
+
+AActor* ULootBagSubsystem::spawnLootBag(TSubclassOf<AActor> bagClass, const FVector& location, const FRotator& rotation)
+{
+	if (!IsValid(bagClass))
+	{
+		return nullptr;
+	}
+
+	bagClasses.Add(bagClass);
+
+	for (int i = pool.Num() - 1; i >= 0; --i)
+	{
+		AActor* pooledBag = pool[i].Get();
+
+		if (!IsValid(pooledBag))
+		{
+			pool.RemoveAtSwap(i);
+		}
+		else if (pooledBag->GetClass() == bagClass)
+		{
+			pool.RemoveAtSwap(i);
+			pooledBag->SetActorLocationAndRotation(location, rotation);
+			pooledBag->SetActorHiddenInGame(false);
+			pooledBag->SetActorEnableCollision(true);
+			pooledBag->SetActorTickEnabled(true);
+			return pooledBag;
+		}
+	}
+
+	return GetWorld()->SpawnActor<AActor>(bagClass, location, rotation);
+}
+
+void ULootBagSubsystem::releaseLootBag(AActor* bag)
+{
+	if (!IsValid(bag) || isPooled(bag))
+	{
+		return;
+	}
+
+	UInventoryComponent* bagInv = getBagInventory(bag);
+
+	if (bagInv != nullptr && bagInv->isEmpty() && pool.Num() < CVarLootBagMaxPooled.GetValueOnGameThread())
+	{
+		bag->SetActorHiddenInGame(true);
+		bag->SetActorEnableCollision(false);
+		bag->SetActorTickEnabled(false);
+		pool.Add(bag);
+		++stats.bagsPooledTotal;
+	}
+	else
+	{
+		bag->Destroy();
+		++stats.bagsDestroyedTotal;
+	}
+}
+
+bool ULootBagSubsystem::isPooled(const AActor* bag) const
+{
+	for (const TWeakObjectPtr<AActor>& pooledBag : pool)
+	{
+		if (pooledBag.Get() == bag)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+FLootBagConsolidationStats ULootBagSubsystem::getStats()
+{
+	stats.bagsInPool = pool.Num();
+	return stats;
+}
+
+UInventoryComponent* ULootBagSubsystem::getBagInventory(AActor* bag)
+{
+	if (!IsValid(bag))
+	{
+		return nullptr;
+	}
+
+	return Cast<UInventoryComponent>(bag->GetComponentByClass(UInventoryComponent::StaticClass()));
+}
@@ -1,18 +1,46 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "SimpleInventory.h"
+#include "ItemCatalog.h"
+
+#if WITH_EDITOR
+#include "ItemCatalogCommandlet.h"
+#include "UObject/ICookInfo.h"
+#endif
 
 #define LOCTEXT_NAMESPACE "FSimpleInventoryModule"
 
 void FSimpleInventoryModule::StartupModule()
 {
 	// This code will execute after your module is loaded into memory; the exact timing is specified in the .uplugin file per-module
+
+#if WITH_EDITOR
+	//Every cook bakes a fresh catalog from the assets as they are now, so a stale one can't ship
+	cookStartedHandle = UE::Cook::FDelegates::CookByTheBookStarted.AddLambda([](UE::Cook::ICookInfo& cookInfo)
+	{
+		UItemCatalogCommandlet::buildCatalog(FItemCatalog::getDefaultPath());
+	});
+
+	//In the editor the assets themselves are the truth, designers change them without rebaking
+	if (GIsEditor)
+	{
+		return;
+	}
+#endif
+
+	//Missing if it was never baked, everything falls back to reading the item assets
+	FItemCatalog::get().load(FItemCatalog::getDefaultPath());
 }
 
 void FSimpleInventoryModule::ShutdownModule()
 {
 	// This function may be called during shutdown to clean up your module.  For modules that support dynamic reloading,
 	// we call this function before unloading the module.
+#if WITH_EDITOR
+	UE::Cook::FDelegates::CookByTheBookStarted.Remove(cookStartedHandle);
+#endif
+
+	FItemCatalog::get().reset();
 }
 
 #undef LOCTEXT_NAMESPACE
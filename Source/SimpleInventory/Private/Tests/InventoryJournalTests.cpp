@@ -0,0 +1,193 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "InventoryJournal.h"
+#include "HAL/FileManager.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace InventoryJournalTests
+{
+	static const FString containerId = TEXT("TestChest");
+
+	//Fresh folder under the automation transient dir, emptied out first in case an earlier run stopped halfway
+	static FString makeTestDir(const TCHAR* testName)
+	{
+		FString dir = FPaths::AutomationTransientDir() / TEXT("InventoryJournal") / testName;
+		IFileManager::Get().DeleteDirectory(*dir, false, true);
+		IFileManager::Get().MakeDirectory(*dir, true);
+		return dir;
+	}
+
+	static FJournalSlotState makeSlot(int32 itemId, int32 quantity)
+	{
+		FJournalSlotState slotState;
+		slotState.hasItem = true;
+		slotState.itemId = itemId;
+		slotState.quantity = quantity;
+		return slotState;
+	}
+
+	//Writes one segment with the given slot records, sequence numbers go up from firstSequence
+	static bool writeSegment(const FString& path, uint64 firstSequence, TArrayView<const TPair<int32, FJournalSlotState>> slots)
+	{
+		FInventoryJournalWriter writer;
+		if (!writer.open(path))
+		{
+			return false;
+		}
+
+		uint64 sequence = firstSequence;
+		for (const TPair<int32, FJournalSlotState>& slot : slots)
+		{
+			writer.appendSlot(sequence++, containerId, slot.Key, slot.Value);
+		}
+
+		bool flushed = writer.flush();
+		writer.close();
+		return flushed;
+	}
+
+	static int32 getQuantity(const FJournalState& state, int32 slot)
+	{
+		const FJournalContainerState* container = state.containers.Find(containerId);
+		return container && container->slots.IsValidIndex(slot) && container->slots[slot].hasItem ? container->slots[slot].quantity : -1;
+	}
+}
+
+using namespace InventoryJournalTests;
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FInventoryJournalTornTailTest, "SimpleInventory.Journal.TornTail",
+	EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FInventoryJournalTornTailTest::RunTest(const FString& Parameters)
+{
+	FString dir = makeTestDir(TEXT("TornTail"));
+	FString segmentPath = dir / TEXT("journal_000000.bin");
+
+	TPair<int32, FJournalSlotState> slots[] = { { 0, makeSlot(1, 5) }, { 1, makeSlot(2, 3) }, { 2, makeSlot(3, 8) } };
+	TestTrue(TEXT("Segment written"), writeSegment(segmentPath, 1, slots));
+
+	TArray<uint8> fileData;
+	TestTrue(TEXT("Segment read back"), FFileHelper::LoadFileToArray(fileData, *segmentPath));
+
+	//Crash partway through writing the last record
+	TArray<uint8> tornData = fileData;
+	tornData.SetNum(tornData.Num() - 3);
+	FFileHelper::SaveArrayToFile(tornData, *segmentPath);
+
+	FJournalState tornState;
+	FInventoryJournalFile::replaySegment(segmentPath, tornState, 0);
+	TestEqual(TEXT("Whole records before the torn one are replayed"), getQuantity(tornState, 1), 3);
+	TestEqual(TEXT("The torn record is dropped"), getQuantity(tornState, 2), -1);
+	TestEqual(TEXT("Sequence stops at the last whole record"), tornState.lastSequence, static_cast<uint64>(2));
+
+	//Full length on disk but the last bytes never made it, so the crc doesn't match
+	TArray<uint8> corruptData = fileData;
+	corruptData.Last() ^= 0xFF;
+	FFileHelper::SaveArrayToFile(corruptData, *segmentPath);
+
+	FJournalState corruptState;
+	FInventoryJournalFile::replaySegment(segmentPath, corruptState, 0);
+	TestEqual(TEXT("A record failing its crc is dropped"), getQuantity(corruptState, 2), -1);
+	TestEqual(TEXT("Records before the bad crc are kept"), getQuantity(corruptState, 0), 5);
+
+	IFileManager::Get().DeleteDirectory(*dir, false, true);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FInventoryJournalCheckpointCrashTest, "SimpleInventory.Journal.CrashAfterCheckpoint",
+	EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FInventoryJournalCheckpointCrashTest::RunTest(const FString& Parameters)
+{
+	FString dir = makeTestDir(TEXT("CrashAfterCheckpoint"));
+	FString checkpointPath = dir / TEXT("checkpoint.bin");
+	FString firstSegment = dir / TEXT("journal_000000.bin");
+	FString secondSegment = dir / TEXT("journal_000001.bin");
+
+	TPair<int32, FJournalSlotState> firstSlots[] = { { 0, makeSlot(1, 1) }, { 0, makeSlot(1, 2) }, { 1, makeSlot(2, 4) } };
+	writeSegment(firstSegment, 1, firstSlots);
+
+	//Fold the first segment, then crash before it is deleted
+	FJournalState folded;
+	FInventoryJournalFile::recover(checkpointPath, MakeArrayView(&firstSegment, 1), folded);
+	TestTrue(TEXT("Checkpoint written"), FInventoryJournalFile::writeCheckpoint(checkpointPath, folded));
+	TestTrue(TEXT("Folded segment is still on disk"), IFileManager::Get().FileExists(*firstSegment));
+
+	//The next session carried on in a new segment before crashing again, and left a half written checkpoint behind
+	TPair<int32, FJournalSlotState> secondSlots[] = { { 1, makeSlot(2, 9) } };
+	writeSegment(secondSegment, 4, secondSlots);
+	TArray<uint8> junk = { 1, 2, 3 };
+	FFileHelper::SaveArrayToFile(junk, *(checkpointPath + TEXT(".tmp")));
+
+	FJournalState recovered;
+	FString segments[] = { firstSegment, secondSegment };
+	FInventoryJournalFile::recover(checkpointPath, segments, recovered);
+
+	TestEqual(TEXT("Slot only in the checkpoint and the stale segment"), getQuantity(recovered, 0), 2);
+	TestEqual(TEXT("Slot changed after the checkpoint"), getQuantity(recovered, 1), 9);
+	TestEqual(TEXT("Sequence carries on from the newest record"), recovered.lastSequence, static_cast<uint64>(4));
+
+	//A checkpoint that was cut short is ignored rather than trusted
+	TArray<uint8> checkpointData;
+	FFileHelper::LoadFileToArray(checkpointData, *checkpointPath);
+	checkpointData.SetNum(checkpointData.Num() / 2);
+	FFileHelper::SaveArrayToFile(checkpointData, *checkpointPath);
+
+	FJournalState fromSegments;
+	TestFalse(TEXT("Torn checkpoint is rejected"), FInventoryJournalFile::readCheckpoint(checkpointPath, fromSegments));
+	FInventoryJournalFile::recover(checkpointPath, segments, fromSegments);
+	TestEqual(TEXT("Segments still rebuild the slot"), getQuantity(fromSegments, 1), 9);
+
+	IFileManager::Get().DeleteDirectory(*dir, false, true);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FInventoryJournalSequenceSkipTest, "SimpleInventory.Journal.SkipBySequence",
+	EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FInventoryJournalSequenceSkipTest::RunTest(const FString& Parameters)
+{
+	FString dir = makeTestDir(TEXT("SkipBySequence"));
+	FString checkpointPath = dir / TEXT("checkpoint.bin");
+	FString segmentPath = dir / TEXT("journal_000000.bin");
+
+	FJournalState checkpoint;
+	checkpoint.lastSequence = 5;
+	checkpoint.containers.Add(containerId).slots.Add(makeSlot(1, 9));
+	TestTrue(TEXT("Checkpoint written"), FInventoryJournalFile::writeCheckpoint(checkpointPath, checkpoint));
+
+	//Sequence 4 is older than the checkpoint and must not roll slot 0 back, 6 is newer and applies
+	TPair<int32, FJournalSlotState> olderSlots[] = { { 0, makeSlot(1, 1) } };
+	TPair<int32, FJournalSlotState> newerSlots[] = { { 1, makeSlot(2, 3) } };
+	FInventoryJournalWriter writer;
+	TestTrue(TEXT("Segment opened"), writer.open(segmentPath));
+	writer.appendSlot(4, containerId, olderSlots[0].Key, olderSlots[0].Value);
+	writer.appendSlot(6, containerId, newerSlots[0].Key, newerSlots[0].Value);
+	writer.close();
+
+	FJournalState recovered;
+	FInventoryJournalFile::recover(checkpointPath, MakeArrayView(&segmentPath, 1), recovered);
+
+	TestEqual(TEXT("Record at or below the checkpoint sequence is skipped"), getQuantity(recovered, 0), 9);
+	TestEqual(TEXT("Record past the checkpoint sequence is applied"), getQuantity(recovered, 1), 3);
+	TestEqual(TEXT("Sequence moves up to the applied record"), recovered.lastSequence, static_cast<uint64>(6));
+
+	//A tombstone past the checkpoint removes the container for good
+	TestTrue(TEXT("Segment reopened"), writer.open(segmentPath));
+	writer.appendRemove(7, containerId);
+	writer.close();
+
+	FJournalState removed;
+	FInventoryJournalFile::recover(checkpointPath, MakeArrayView(&segmentPath, 1), removed);
+	TestFalse(TEXT("Tombstoned container is gone"), removed.containers.Contains(containerId));
+
+	IFileManager::Get().DeleteDirectory(*dir, false, true);
+	return true;
+}
+
+#endif
@@ -0,0 +1,103 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "InventoryTrace.h"
+#include "InventoryComponent.h"
+#include "InventoryReplayCommandlet.h"
+#include "Engine/World.h"
+#include "HAL/FileManager.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/Paths.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace InventoryTraceTests
+{
+	static UItemAsset* makeItem(const TCHAR* name, int32 uniqueID, int32 maxStackSize)
+	{
+		UItemAsset* itemAsset = NewObject<UItemAsset>(GetTransientPackage(), name);
+		itemAsset->uniqueID = uniqueID;
+		itemAsset->maxStackSize = maxStackSize;
+		itemAsset->type = TEXT("Test");
+		//Replay finds it again by path, and it has to outlive the garbage collection after each world
+		itemAsset->AddToRoot();
+		return itemAsset;
+	}
+
+	static UInventoryComponent* spawnInventory(UWorld* world)
+	{
+		AActor* owner = world->SpawnActor<AActor>();
+		UInventoryComponent* comp = NewObject<UInventoryComponent>(owner);
+		owner->AddInstanceComponent(comp);
+		comp->RegisterComponent();
+		return comp;
+	}
+
+	static FInvItem makeStack(UItemAsset* itemAsset, int32 quantity)
+	{
+		FInvItem stack;
+		stack.item = itemAsset;
+		stack.quantity = quantity;
+		return stack;
+	}
+}
+
+using namespace InventoryTraceTests;
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FInventoryTraceRoundTripTest, "SimpleInventory.Trace.RecordAndReplay",
+	EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FInventoryTraceRoundTripTest::RunTest(const FString& Parameters)
+{
+	FString tracePath = FPaths::AutomationTransientDir() / TEXT("InventoryTrace") / TEXT("RecordAndReplay.bin");
+	UItemAsset* apple = makeItem(TEXT("TraceTestApple"), 9001, 10);
+	UItemAsset* sword = makeItem(TEXT("TraceTestSword"), 9002, 1);
+
+	UWorld* world = UInventoryReplayCommandlet::createWorld();
+	UInventoryComponent* player = spawnInventory(world);
+	UInventoryComponent* chest = spawnInventory(world);
+	TestTrue(TEXT("Inventories began play and have their rows"), player->getRows() > 0 && chest->getRows() > 0);
+
+	FInventoryTraceRecorder& recorder = FInventoryTraceRecorder::get();
+	TestTrue(TEXT("Recording started"), recorder.start(tracePath));
+
+	//Drag and drop bursts, a chest dump and a few queries in between
+	player->addNewItem(makeStack(apple, 7));
+	player->addNewItem(makeStack(apple, 6));
+	player->addNewItem(makeStack(sword, 1));
+	player->splitStack(0, 4);
+	player->moveItem(1, 4);
+	player->moveItem(4, 0);
+	player->changeQuantity(apple->uniqueID, -2);
+	player->getItemQuantity(apple->uniqueID);
+	player->moveToNewInvComp(2, chest);
+	chest->addItemAtSlot(makeStack(apple, 3), 3);
+	chest->moveItem(3, 0);
+	player->removeItem(1, false);
+	player->moveAllToNewInvComp(chest);
+	chest->getRemainingCapacity(apple);
+
+	recorder.stop();
+	UInventoryReplayCommandlet::destroyWorld(world);
+
+	FInventoryTrace trace;
+	TestTrue(TEXT("Trace loads"), FInventoryTrace::load(tracePath, trace));
+	TestEqual(TEXT("Every outermost call is recorded, nested ones aren't"), trace.calls.Num(), 14);
+	TestEqual(TEXT("Both inventories are in the trace"), trace.components.Num(), 2);
+
+	UInventoryReplayCommandlet* replayer = NewObject<UInventoryReplayCommandlet>();
+	TestEqual(TEXT("Replay ends every call on its recorded state hash"), replayer->replayTrace(trace), 0);
+	TestEqual(TEXT("Replay timed the moves"), replayer->getStats()[static_cast<int32>(EInventoryTraceOp::MoveItem)].count, 3);
+
+	//A trace that doesn't match what the code does now has to be caught
+	trace.calls.Last().stateHash ^= 1;
+	AddExpectedError(TEXT("state hash"), EAutomationExpectedErrorFlags::Contains, 1);
+	TestEqual(TEXT("A changed hash is reported"), replayer->replayTrace(trace), 1);
+
+	apple->RemoveFromRoot();
+	sword->RemoveFromRoot();
+	IFileManager::Get().Delete(*tracePath, false, true, true);
+	return true;
+}
+
+#endif
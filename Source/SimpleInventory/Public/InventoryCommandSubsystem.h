@@ -0,0 +1,150 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "InventoryItem.h"
+#include "InventoryCommandSubsystem.generated.h"
+
+class UInventoryComponent;
+
+UENUM(BlueprintType)
+enum class EInventoryCommandType : uint8
+{
+	Add,
+	Remove,
+	Move,
+	Split,
+	Transfer,
+	ChangeQuantity
+};
+
+USTRUCT(BlueprintType, Blueprintable)
+struct FInventoryCommandResult
+{
+	GENERATED_USTRUCT_BODY()
+
+public:
+	UPROPERTY(BlueprintReadOnly)
+	EInventoryCommandType type = EInventoryCommandType::Add;
+	//False if the command did nothing or the target was gone by the time it ran
+	UPROPERTY(BlueprintReadOnly)
+	bool success = false;
+	UPROPERTY(BlueprintReadOnly)
+	int leftOvers = 0;
+	//What changeQuantity returned, see its comments for the meaning
+	UPROPERTY(BlueprintReadOnly)
+	int returnValue = 0;
+	UPROPERTY(BlueprintReadOnly)
+	float queuedMs = 0;
+};
+
+USTRUCT(BlueprintType, Blueprintable)
+struct FInventoryCommandStats
+{
+	GENERATED_USTRUCT_BODY()
+
+public:
+	UPROPERTY(BlueprintReadOnly)
+	int pending = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int componentsWaiting = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int executedLastFrame = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int64 executedTotal = 0;
+	//Adds folded into a neighbouring add of the same item instead of running on their own
+	UPROPERTY(BlueprintReadOnly)
+	int64 coalescedTotal = 0;
+	//Turned away because the queue was full
+	UPROPERTY(BlueprintReadOnly)
+	int64 rejectedTotal = 0;
+	UPROPERTY(BlueprintReadOnly)
+	float lastFrameMs = 0;
+	UPROPERTY(BlueprintReadOnly)
+	float oldestPendingMs = 0;
+};
+
+DECLARE_DYNAMIC_DELEGATE_OneParam(FOnInventoryCommandDone, const FInventoryCommandResult&, result);
+
+struct FInventoryCommand
+{
+	EInventoryCommandType type = EInventoryCommandType::Add;
+	FInvItem item;
+	int slot = -1;
+	int otherSlot = -1;
+	int uniqueID = 0;
+	int quantity = 0;
+	bool dropIfNoneAdded = false;
+	bool dropIfPartialAdded = true;
+	bool shouldDrop = true;
+	TWeakObjectPtr<UInventoryComponent> destination;
+
+	double queuedTime = 0;
+	TFunction<void(const FInventoryCommandResult&)> onDone;
+	FOnInventoryCommandDone onDoneBP;
+};
+
+//Queues inventory changes from scripted systems and runs them in batches under a per frame time budget
+//Commands are kept in order per component, each component's batch only broadcasts OnInvChanged once,
+//and back to back adds of the same item are folded into one pass over the inventory
+UCLASS()
+class SIMPLEINVENTORY_API UInventoryCommandSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	//Returns false if the target is invalid or the queue is full
+	bool enqueue(UInventoryComponent* target, FInventoryCommand&& command);
+
+	UFUNCTION(BlueprintCallable, meta = (AutoCreateRefTerm = "onDone", ToolTip = "Queue addNewItem on target"))
+	bool queueAddItem(UInventoryComponent* target, const FInvItem& newItem, const FOnInventoryCommandDone& onDone, bool dropIfNoneAdded = false, bool dropIfPartialAdded = true);
+
+	UFUNCTION(BlueprintCallable, meta = (AutoCreateRefTerm = "onDone", ToolTip = "Queue removeItem on target"))
+	bool queueRemoveItem(UInventoryComponent* target, int slot, const FOnInventoryCommandDone& onDone, bool bShouldDrop = true);
+
+	UFUNCTION(BlueprintCallable, meta = (AutoCreateRefTerm = "onDone", ToolTip = "Queue moveItem on target"))
+	bool queueMoveItem(UInventoryComponent* target, int from, int to, const FOnInventoryCommandDone& onDone);
+
+	UFUNCTION(BlueprintCallable, meta = (AutoCreateRefTerm = "onDone", ToolTip = "Queue splitStack on target"))
+	bool queueSplitStack(UInventoryComponent* target, int slot, int newStackSize, const FOnInventoryCommandDone& onDone);
+
+	UFUNCTION(BlueprintCallable, meta = (AutoCreateRefTerm = "onDone", ToolTip = "Queue moveToNewInvComp from target into newComp"))
+	bool queueTransfer(UInventoryComponent* target, int slot, UInventoryComponent* newComp, const FOnInventoryCommandDone& onDone);
+
+	UFUNCTION(BlueprintCallable, meta = (AutoCreateRefTerm = "onDone", ToolTip = "Queue changeQuantity on target"))
+	bool queueChangeQuantity(UInventoryComponent* target, int uniqueID, int quantityToChange, const FOnInventoryCommandDone& onDone);
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Get queue depth and throughput numbers"))
+	FInventoryCommandStats getStats();
+
+	//Runs everything that is queued right now ignoring the budget, for level transitions and saves
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Run every queued command now"))
+	void flush();
+
+private:
+	struct FComponentQueue
+	{
+		TArray<FInventoryCommand> commands;
+		//Commands before this have run, the array is compacted once the whole queue is done
+		int next = 0;
+	};
+
+	//Runs the next command, or the next run of same item adds, returns how many commands it used
+	int executeNext(UInventoryComponent* target, FComponentQueue& queue, TArray<TPair<FInventoryCommand, FInventoryCommandResult>>& finished);
+	void executeAddRun(UInventoryComponent* target, TArray<FInventoryCommand>& run, TArray<TPair<FInventoryCommand, FInventoryCommandResult>>& finished);
+	void runQueues(double budgetSeconds);
+
+	TMap<TWeakObjectPtr<UInventoryComponent>, FComponentQueue> queues;
+	//Round robin order so one busy container can't starve the rest
+	TArray<TWeakObjectPtr<UInventoryComponent>> componentOrder;
+	int nextComponent = 0;
+	int pendingCount = 0;
+
+	FInventoryCommandStats stats;
+};
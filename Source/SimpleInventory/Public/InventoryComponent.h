@@ -5,9 +5,14 @@
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
 #include "InventoryItem.h"
+#include "InventoryGrid.h"
+#include "InventorySnapshot.h"
+#include "ItemInstancePool.h"
 #include "Kismet/GameplayStatics.h"
 #include "InventoryComponent.generated.h"
 
+class UInventoryJournalSubsystem;
+
 DECLARE_DYNAMIC_MULTICAST_DELEGATE(FOnInvChangedDelegate);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE(FOnRowsAddedDelegate);
 
@@ -23,6 +28,7 @@ public:
 protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ClampMin = "1", UMin = "1", ToolTip = "The number of rows to put in this inventory, rows are 5 columns each."))
@@ -42,7 +48,64 @@ protected:
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (Tooltip = "Amount of the upgrade item needed"))
 	int amtToUpgrade = 1;
 
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ToolTip = "Publish a read only copy after every change so other threads can read this inventory without going through the game thread"))
+	bool publishSnapshots = false;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ToolTip = "Record every slot change to the world's inventory journal and restore from it on begin play"))
+	bool journalChanges = false;
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (EditCondition = "journalChanges", ToolTip = "Name this inventory is saved under, leave empty to use the component's path. Only inventories on actors placed in the level can leave it empty, spawned ones aren't journaled without it"))
+	FName journalId;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ToolTip = "Items take up their footprint in cells instead of one slot, slots per row is capped at 64"))
+	bool useShapedItems = false;
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (EditCondition = "useShapedItems", ToolTip = "Let auto placement rotate items to make them fit"))
+	bool allowRotation = true;
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (EditCondition = "useShapedItems", ToolTip = "Pack items against others and the edges instead of taking the first spot that fits"))
+	bool useBestFit = false;
+
 	UItemAsset* findItemAssetByID(int uniqueID);
+	int findEmptySlotFor(UItemAsset* itemAsset, bool& outRotated);
+	int getNewStackCapacity(UItemAsset* itemAsset);
+	FAddItemStatus giveItemTo(const FInvItem& item, UInventoryComponent* newComp, bool dropIfNoneAdded, bool dropIfPartialAdded);
+	FInvGridPlacement makePlacement(int slot, UItemAsset* itemAsset, bool rotated);
+	bool moveShapedItem(int from, int to);
+
+	//Every write to inventoryArray goes through these so the running totals below stay in sync
+	void setSlot(int slot, const FInvItem& newItem, bool rotated = false);
+	void setSlotQuantity(int slot, int newQuantity);
+	bool replaceSlots(const TArray<FInvItem>& newInv);
+	void applySlotToTotals(const FInvItem& slotItem, int sign);
+	//Use instead of OnInvChanged.Broadcast() so snapshots go out with every committed change
+	void broadcastInvChanged();
+
+	TMap<int, FInvItemTotals> itemTotals;
+	TMap<FName, FInvItemTotals> typeTotals;
+	int64 totalValue = 0;
+	int emptySlots = 0;
+
+	//Shaped mode only, the item sits in inventoryArray at its top left slot and the other cells it covers stay empty
+	FInventoryGrid grid;
+	TMap<int, FInvGridPlacement> placements;
+
+	TSharedPtr<FInventorySnapshotPublisher, ESPMode::ThreadSafe> snapshotPublisher;
+	bool snapshotDirty = true;
+	uint32 snapshotVersion = 0;
+
+	int batchDepth = 0;
+	bool broadcastPending = false;
+
+	FItemInstancePool instancePool;
+
+	UPROPERTY(Transient)
+	UInventoryJournalSubsystem* journal = nullptr;
+	FString journalKey;
+	void startJournal();
+	void restoreFromJournal();
+	void journalSlot(int slot);
+
+	//The trace records and rebuilds inventories straight from their setup
+	friend class FInventoryTraceRecorder;
+	friend class UInventoryReplayCommandlet;
 
 public:	
 	UPROPERTY(BlueprintAssignable, Category = "Delegates")
@@ -72,6 +135,9 @@ public:
 	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Move from one inventory comp to another"))
 	bool moveToNewInvComp(int slot, UInventoryComponent* newComp);
 
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Move everything that fits into another inventory comp, returns true if this one ends up empty"))
+	bool moveAllToNewInvComp(UInventoryComponent* newComp);
+
 	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Get the amount of an item in this inventory"))
 	int getItemQuantity(int uniqueID);
 
@@ -105,6 +171,21 @@ public:
 	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Load inventory from array"))
 	void loadInventory(TArray<FInvItem> newInv);
 
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Get a copy of the inventory along with the instance data of its items, for saving"))
+	FInventorySaveData saveInventory();
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Load inventory and instance data from saveInventory"))
+	void loadSavedInventory(FInventorySaveData saveData);
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Get the instance data of the item at a slot, false if it has none"))
+	bool getInstanceData(int slot, FItemInstanceData& outData);
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Set the instance data of the item at a slot, an item with instance data no longer stacks"))
+	bool setInstanceData(int slot, const FItemInstanceData& newData);
+
+	//Null if the slot has no instance data, only valid until the next change to this inventory
+	FItemInstanceData* findInstanceData(int slot);
+
 	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Get amount of upgrade item needed to upgrage"))
 	int getAmtToUpgrade() { return amtToUpgrade; }
 
@@ -112,8 +193,49 @@ public:
 	TSubclassOf<class AActor> getLootBagClass() { return lootBag; } 
 
 	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Get free slots in bag"))
-	int getAmountOfEmptySlots() { return getItemQuantity(-1); }
+	int getAmountOfEmptySlots() { return useShapedItems ? grid.getFreeCells() : emptySlots; }
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Get the cells the item at this slot covers, width is 0 if there is no shaped item there"))
+	FInvGridPlacement getItemPlacement(int slot);
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Check if an item would fit with its top left corner at this slot"))
+	bool canPlaceItemAt(UItemAsset* itemAsset, int slot, bool rotated = false);
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Turn a shaped item 90 degrees in place if there is room"))
+	bool rotateItem(int slot);
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Get the combined buy price of everything in the inventory"))
+	int64 getTotalValue() { return totalValue; }
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Get the number of different items in the inventory"))
+	int getDistinctItemCount() { return itemTotals.Num(); }
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Get the amount of all items of a specific type in the inventory"))
+	int getTypeQuantity(const FName type);
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Get how many more of an item this inventory can take, partial stacks plus empty slots"))
+	int getRemainingCapacity(UItemAsset* itemAsset);
 
 	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Get slots per row"))
 	int getSlotsPerRow() { return slotsPerRow; }
+
+	//Hold OnInvChanged until the matching endBatch so a run of changes only broadcasts once, calls can nest
+	void beginBatch();
+	void endBatch();
+
+	//Safe from any thread, null until the first publish or if publishSnapshots is off
+	FInventorySnapshotRef getSnapshot() const { return snapshotPublisher->acquire(); }
+
+	//Hold onto this from worker threads to keep reading snapshots without touching the component itself
+	TSharedPtr<FInventorySnapshotPublisher, ESPMode::ThreadSafe> getSnapshotPublisher() const { return snapshotPublisher; }
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Set the name this inventory is journaled under, for spawned inventories. Starts journaling if begin play couldn't, does nothing once journaling has started"))
+	void setJournalId(FName newJournalId);
+
+	//Copy of an item with its instance handle dropped unless it is one of this inventory's and not in a slot already
+	//Handles from another inventory's pool mean nothing here, only moveToNewInvComp carries the data itself across
+	FInvItem adoptItem(const FInvItem& newItem) const;
+
+	//Hash of every slot's item ID and quantity, two inventories with the same contents in the same places match
+	uint64 getStateHash() const;
 };
@@ -0,0 +1,60 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "InventoryGrid.generated.h"
+
+//Where a multi cell item sits in the grid, column and row are the top left cell
+USTRUCT(BlueprintType, Blueprintable)
+struct FInvGridPlacement
+{
+	GENERATED_USTRUCT_BODY()
+
+public:
+	UPROPERTY(BlueprintReadOnly)
+	int column = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int row = 0;
+	//Width and height after rotation
+	UPROPERTY(BlueprintReadOnly)
+	int width = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int height = 0;
+	UPROPERTY(BlueprintReadOnly)
+	bool rotated = false;
+};
+
+//Occupancy for inventories with shaped items, one 64 bit mask per row where bit n is column n
+//Fit checks AND/OR whole rows at once so checking a spot costs one op per row the item covers
+struct SIMPLEINVENTORY_API FInventoryGrid
+{
+public:
+	static constexpr int maxColumns = 64;
+
+	void reset(int numColumns, int numRows);
+	void addRows(int numRows);
+
+	int getRows() const { return rowBits.Num(); }
+	int getColumns() const { return columns; }
+	int getFreeCells() const { return columns * rowBits.Num() - occupiedCells; }
+
+	bool canPlace(int column, int row, int width, int height) const;
+	void setCells(const FInvGridPlacement& placement, bool occupied);
+
+	//Top-most then left-most spot, unrotated wins ties
+	bool findFirstFit(int width, int height, bool allowRotation, FInvGridPlacement& outPlacement) const;
+	//Spot touching the most occupied cells or grid edges, keeps big gaps free for big items
+	bool findBestFit(int width, int height, bool allowRotation, FInvGridPlacement& outPlacement) const;
+
+private:
+	uint64 spanMask(int column, int width) const;
+	//Bit n set means a width x height item fits with its top left at (n, row)
+	uint64 fitStarts(int row, int width, int height) const;
+	int contactScore(int column, int row, int width, int height) const;
+
+	TArray<uint64> rowBits;
+	uint64 fullRow = 0;
+	int columns = 0;
+	int occupiedCells = 0;
+};
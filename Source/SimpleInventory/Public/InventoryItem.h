@@ -22,6 +22,15 @@ public:
 	int leftOvers = 0;
 };
 
+//Running totals for one item ID or item type, kept up to date as slots change
+struct FInvItemTotals
+{
+	int quantity = 0;
+	int stacks = 0;
+	//Room left in the partial stacks before they hit maxStackSize
+	int freeSpace = 0;
+};
+
 USTRUCT(BlueprintType, Blueprintable)
 struct FInvTableItem : public FTableRowBase
 {
@@ -60,9 +69,31 @@ public:
 
 	UPROPERTY(EditAnywhere, BlueprintReadOnly)
 	int buyPrice = 10;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ClampMin = "1", UIMin = "1", ToolTip = "Width and height in grid cells, only used by inventories with shaped items turned on"))
+	FIntPoint footprint = FIntPoint(1, 1);
+
+	FIntPoint getFootprint() const { return FIntPoint(FMath::Max(footprint.X, 1), FMath::Max(footprint.Y, 1)); }
 };
 
 
+//Per item state that doesn't belong on the asset, kept in the owning inventory's instance pool
+USTRUCT(BlueprintType, Blueprintable)
+struct FItemInstanceData
+{
+	GENERATED_USTRUCT_BODY()
+
+public:
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	float durability = 1.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TMap<FName, float> rolledStats;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FName owner = NAME_None;
+};
+
 USTRUCT(BlueprintType, Blueprintable)
 struct FInvItem
 {
@@ -75,17 +106,32 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ClampMin = "0", ClampMax = "99", UIMin = "0", UIMax = "99"))
 	int32 quantity;
 
+	//Handle into the owning inventory's instance pool, 0 means no instance data
+	//Carries a tag for the pool so other inventories can tell it isn't theirs, moveToNewInvComp carries the data across
+	//Not a UPROPERTY so it never ends up in Blueprint values or save games
+	uint32 instanceHandle : 31;
+
+	//Turned 90 degrees in an inventory with shaped items, kept with the item so saved layouts load back the same
+	//Shares the handle's word so copies of FInvItem stay 16 bytes
+	UPROPERTY(BlueprintReadOnly)
+	uint32 rotated : 1;
+
 
 	FInvItem()
 	{
 		item = nullptr;
 		quantity = 0;
+		instanceHandle = 0;
+		rotated = false;
 	}
 
+	bool hasInstanceData() const { return instanceHandle != 0; }
+
+	//Items with instance data are one of a kind so they never count as the same item for stacking
 	bool operator==(const FInvItem& other) const 
 	{
 
-		if (IsValid(item) && IsValid(other.item)) { return item->uniqueID == other.item->uniqueID; }
+		if (IsValid(item) && IsValid(other.item) && !hasInstanceData() && !other.hasInstanceData()) { return item->uniqueID == other.item->uniqueID; }
 		else { return false; }
 	}
 
@@ -93,7 +139,7 @@ public:
 	{
 		if (IsValid(item) && IsValid(other.item))
 		{
-			return !(item->uniqueID == other.item->uniqueID);
+			return !(*this == other);
 		}
 		else
 		{
@@ -101,4 +147,22 @@ public:
 		}
 	}
 };
+static_assert(sizeof(FInvItem) == sizeof(UItemAsset*) + 8, "FInvItem is copied by value out of every inventory call, keep it small");
+
+//Inventory contents with the instance data pulled out of the pool, instanceSlots says which slot each instanceData entry belongs to
+USTRUCT(BlueprintType, Blueprintable)
+struct FInventorySaveData
+{
+	GENERATED_USTRUCT_BODY()
+
+public:
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<FInvItem> items;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<FItemInstanceData> instanceData;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<int32> instanceSlots;
+};
 //
\ No newline at end of file
@@ -0,0 +1,76 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "InventoryItem.h"
+
+//What the journal knows about one slot, items are kept as IDs so none of this touches UObjects
+struct FJournalSlotState
+{
+	bool hasItem = false;
+	int32 itemId = 0;
+	int32 quantity = 0;
+	bool rotated = false;
+	bool hasInstanceData = false;
+	FItemInstanceData instanceData;
+};
+
+struct FJournalContainerState
+{
+	TArray<FJournalSlotState> slots;
+};
+
+//A checkpoint, or a checkpoint with journal segments replayed on top
+struct FJournalState
+{
+	//Highest sequence number folded in, records at or below this are skipped on replay
+	uint64 lastSequence = 0;
+	TMap<FString, FJournalContainerState> containers;
+	//Item ID to asset path so replay can load the asset
+	TMap<int32, FString> itemPaths;
+};
+
+//Journal segments are a header followed by records of [payload size][payload crc][payload]
+//Replay stops at the first record that is cut short or fails its crc, which is where a crash mid write leaves off
+//Checkpoints are written to a temp file and renamed over the old one so there is always one whole checkpoint on disk
+class SIMPLEINVENTORY_API FInventoryJournalFile
+{
+public:
+	static bool readCheckpoint(const FString& path, FJournalState& outState);
+	static bool writeCheckpoint(const FString& path, const FJournalState& state);
+	static void replaySegment(const FString& path, FJournalState& state, uint64 skipUpTo);
+	//Checkpoint then segments in order, skipping anything the checkpoint already has
+	static void recover(const FString& checkpointPath, TArrayView<const FString> segmentPaths, FJournalState& outState);
+	static void serializeInstanceData(FArchive& ar, FItemInstanceData& data);
+};
+
+//Appends records for the segment currently being written, game thread only
+//Records pile up in memory until flush so a save only costs writing what changed since the last one
+class SIMPLEINVENTORY_API FInventoryJournalWriter
+{
+public:
+	~FInventoryJournalWriter();
+
+	bool open(const FString& path);
+	void close();
+	bool isOpen() const { return file.IsValid(); }
+
+	void appendSlot(uint64 sequence, const FString& containerId, int32 slot, const FJournalSlotState& slotState);
+	void appendResize(uint64 sequence, const FString& containerId, int32 numSlots);
+	//Tombstone, replay drops everything it had for the container
+	void appendRemove(uint64 sequence, const FString& containerId);
+	void appendItemPath(int32 itemId, const FString& path);
+
+	bool flush();
+	int64 getPendingBytes() const { return pending.Num(); }
+
+private:
+	uint32 internContainer(const FString& containerId);
+	void appendRecord(const TArray<uint8>& payload);
+
+	TUniquePtr<FArchive> file;
+	TArray<uint8> pending;
+	//Container IDs are written out once per segment and referred to by index after that
+	TMap<FString, uint32> containerIndices;
+};
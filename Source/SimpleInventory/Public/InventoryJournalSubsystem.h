@@ -0,0 +1,67 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Async/Future.h"
+#include "InventoryJournal.h"
+#include "InventoryJournalSubsystem.generated.h"
+
+class UItemAsset;
+
+//Per world write-ahead journal for inventories with journalChanges on
+//Slot changes are appended as small records, flushed to the current segment on an interval or on flushJournal,
+//and every so often a background task folds the closed segments into the checkpoint. On startup the last
+//checkpoint plus whatever segments are left are replayed and handed to components as they begin play.
+UCLASS()
+class SIMPLEINVENTORY_API UInventoryJournalSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	void recordSlot(const FString& containerId, int slot, const FInvItem& slotItem, const FItemInstanceData* instanceData);
+	void recordResize(const FString& containerId, int numSlots);
+	//The container is gone for good, it is dropped from the journal and the next checkpoint
+	void recordRemove(const FString& containerId);
+
+	//What the journal had for this container when the world started, null if it has never seen it
+	const FJournalContainerState* findRecoveredContainer(const FString& containerId) const;
+	UItemAsset* resolveItem(int32 itemId);
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Write out every change recorded since the last flush, call this when saving"))
+	bool flushJournal();
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Start folding the journal into the checkpoint now instead of waiting for the interval"))
+	void requestCheckpoint();
+
+private:
+	FString getSegmentPath(int32 segment) const;
+	FString getCheckpointPath() const;
+	void startFold();
+
+	FString journalDir;
+	int32 currentSegment = 0;
+	uint64 sequence = 0;
+	FInventoryJournalWriter writer;
+
+	//Segments no longer being written to and waiting to be folded
+	TArray<int32> closedSegments;
+	TArray<int32> foldingSegments;
+	TFuture<bool> foldTask;
+
+	FJournalState recovered;
+	TSet<int32> writtenItemPaths;
+
+	UPROPERTY(Transient)
+	TMap<int32, UItemAsset*> resolvedItems;
+
+	float timeSinceFlush = 0;
+	float timeSinceCheckpoint = 0;
+};
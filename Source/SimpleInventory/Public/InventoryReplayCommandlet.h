@@ -0,0 +1,51 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "InventoryTrace.h"
+#include "InventoryReplayCommandlet.generated.h"
+
+class UInventoryComponent;
+
+//Replays a trace from SimpleInventory.Trace.Start against fresh inventories in a headless game world
+//Run with -run=InventoryReplay -Trace=<file> [-Repeat=<count>]
+//Fails if any call leaves its inventory with a different state hash than it had when recorded
+UCLASS()
+class SIMPLEINVENTORY_API UInventoryReplayCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UInventoryReplayCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+	//Runs the trace repeat times, each in a new world, and returns how many calls didn't end on their recorded state hash
+	int32 replayTrace(const FInventoryTrace& trace, int32 repeat = 1);
+
+	//Headless game world that has begun play, so inventories spawned in it run BeginPlay
+	static UWorld* createWorld();
+	static void destroyWorld(UWorld* world);
+
+	struct FOpStats
+	{
+		int32 count = 0;
+		uint64 totalCycles = 0;
+		uint64 maxCycles = 0;
+		uint64 recordedCycles = 0;
+	};
+
+	//Timing per EInventoryTraceOp from the last replayTrace
+	const TArray<FOpStats>& getStats() const { return stats; }
+
+private:
+
+	UInventoryComponent* spawnComponent(UWorld* world, const FInventoryTraceComponent& traced);
+	FInvItem makeItem(const FInventoryTraceSlot& slot) const;
+	uint64 replayCall(const FInventoryTraceCall& call, UInventoryComponent* comp, UInventoryComponent* other);
+
+	TMap<int32, UItemAsset*> items;
+	TArray<FOpStats> stats;
+};
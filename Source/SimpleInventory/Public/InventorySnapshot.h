@@ -0,0 +1,77 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/RefCounting.h"
+#include "Misc/ScopeLock.h"
+#include "InventoryItem.h"
+#include <atomic>
+
+//Plain copy of a slot, no UObject pointers so it is safe to read from any thread
+struct FInvSnapshotSlot
+{
+	int uniqueID = -1;
+	FName type = NAME_None;
+	int quantity = 0;
+	int maxStackSize = 0;
+	int buyPrice = 0;
+};
+
+//Read only copy of an inventory taken on the game thread after a change, never modified once built
+class SIMPLEINVENTORY_API FInventorySnapshot : public FRefCountBase
+{
+public:
+	FInventorySnapshot(const TArray<FInvItem>& inventory, const TMap<int, FInvItemTotals>& itemTotals, const TMap<FName, FInvItemTotals>& typeTotals,
+		int emptySlots, int64 totalValue, uint32 version);
+
+	//-1 gives the amount of empty slots
+	int getItemQuantity(int uniqueID) const;
+	int getTypeQuantity(const FName type) const;
+	bool itemTypeExists(const FName type) const { return typeQuantities.Contains(type); }
+	//-1 returned means no item of type found
+	int findNextItemOfType(int startPos, int direction, const FName type) const;
+
+	int getAmountOfEmptySlots() const { return emptySlots; }
+	int64 getTotalValue() const { return totalValue; }
+	int getNumSlots() const { return slots.Num(); }
+	FInvSnapshotSlot getItemAtSlot(int slot) const { return slots.IsValidIndex(slot) ? slots[slot] : FInvSnapshotSlot(); }
+
+	//Goes up by one every time the owning inventory publishes
+	uint32 getVersion() const { return version; }
+
+private:
+	TArray<FInvSnapshotSlot> slots;
+	TMap<int, int> itemQuantities;
+	TMap<FName, int> typeQuantities;
+	int emptySlots = 0;
+	int64 totalValue = 0;
+	uint32 version = 0;
+};
+
+typedef TRefCountPtr<const FInventorySnapshot> FInventorySnapshotRef;
+
+//Hands out the latest snapshot without locks. Only the game thread publishes, any thread can acquire.
+//Readers count themselves in activeReaders around loading the pointer and taking a reference, and a
+//replaced snapshot is only let go of after seeing no readers in that window, so nobody can be left
+//holding a pointer to a snapshot that is being freed. The last reader out of the window frees what is
+//waiting, and the game thread tries again on publish and releaseRetired in case that reader lost the race.
+class SIMPLEINVENTORY_API FInventorySnapshotPublisher
+{
+public:
+	~FInventorySnapshotPublisher();
+
+	void publish(FInventorySnapshot* newSnapshot);
+	FInventorySnapshotRef acquire() const;
+	//Frees replaced snapshots if no reader is in the window, blocking only if block is set
+	void releaseRetired(bool block = true) const;
+
+private:
+	std::atomic<const FInventorySnapshot*> current{ nullptr };
+	mutable std::atomic<int32> activeReaders{ 0 };
+	//Replaced snapshots still waiting for the reader window to be clear
+	mutable TArray<const FInventorySnapshot*> retired;
+	mutable FCriticalSection retiredLock;
+	//Lets readers skip the lock when nothing is waiting
+	mutable std::atomic<int32> retiredCount{ 0 };
+};
@@ -0,0 +1,133 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "InventoryItem.h"
+
+class UInventoryComponent;
+
+enum class EInventoryTraceOp : uint8
+{
+	AddNewRows,
+	AddNewItem,
+	AddItemAtSlot,
+	MoveItem,
+	RemoveItem,
+	MoveToNewInvComp,
+	MoveAllToNewInvComp,
+	ChangeQuantity,
+	SplitStack,
+	CreateLootBag,
+	LoadInventory,
+	RotateItem,
+	GetItemQuantity,
+	GetItemAtSlot,
+	GetRemainingCapacity,
+	Count
+};
+
+struct FInventoryTraceSlot
+{
+	//-1 for an empty slot
+	int32 itemId = -1;
+	int32 quantity = 0;
+	bool rotated = false;
+};
+
+//An inventory as it was the first time the trace saw it, replay starts a fresh component from this
+struct FInventoryTraceComponent
+{
+	FString name;
+	int32 rows = 1;
+	int32 maxRows = 5;
+	int32 slotsPerRow = 5;
+	bool useShapedItems = false;
+	bool allowRotation = true;
+	bool useBestFit = false;
+	float mergeDist = 500;
+	FString lootBagClass;
+	FVector location = FVector::ZeroVector;
+	TArray<FInventoryTraceSlot> slots;
+};
+
+struct FInventoryTraceCall
+{
+	EInventoryTraceOp op = EInventoryTraceOp::Count;
+	int32 component = INDEX_NONE;
+	int32 otherComponent = INDEX_NONE;
+	//Microseconds since recording started
+	uint64 timestamp = 0;
+	uint64 durationCycles = 0;
+	TArray<int32> args;
+	//Items passed in, one for most calls or the whole array for loadInventory
+	TArray<FInventoryTraceSlot> items;
+	//getStateHash of the target after the call returned
+	uint64 stateHash = 0;
+};
+
+struct SIMPLEINVENTORY_API FInventoryTrace
+{
+	double secondsPerCycle = 0;
+	TMap<int32, FString> itemPaths;
+	TArray<FInventoryTraceComponent> components;
+	TArray<FInventoryTraceCall> calls;
+
+	static bool load(const FString& path, FInventoryTrace& outTrace);
+	static const TCHAR* getOpName(EInventoryTraceOp op);
+};
+
+//Opt in recorder for public UInventoryComponent calls, game thread only
+//Start and stop it with SimpleInventory.Trace.Start <file> and SimpleInventory.Trace.Stop
+//Items and components are written the first time a call touches them so the file can be replayed from scratch
+class SIMPLEINVENTORY_API FInventoryTraceRecorder
+{
+public:
+	static FInventoryTraceRecorder& get();
+
+	bool isRecording() const { return file.IsValid(); }
+	bool start(const FString& path);
+	void stop();
+
+	//Only the outermost call is recorded, anything it calls on the way is part of it
+	bool enterCall() { return callDepth++ == 0 && isRecording(); }
+	void leaveCall() { --callDepth; }
+
+	void internComponent(UInventoryComponent* comp);
+	void internItem(const UItemAsset* itemAsset);
+	void recordCall(const FInventoryTraceCall& call);
+	uint64 getTimestamp() const;
+	int32 getComponentIndex(const UInventoryComponent* comp) const;
+
+private:
+	void flushBuffer();
+
+	TUniquePtr<FArchive> file;
+	TArray<uint8> buffer;
+	uint64 startCycles = 0;
+	uint64 lastTimestamp = 0;
+	int callDepth = 0;
+
+	TMap<TWeakObjectPtr<const UInventoryComponent>, int32> componentIndices;
+	TSet<int32> writtenItems;
+};
+
+//Calls made while one of these is alive aren't recorded
+struct FInventoryTraceSuspend
+{
+	FInventoryTraceSuspend() { FInventoryTraceRecorder::get().enterCall(); }
+	~FInventoryTraceSuspend() { FInventoryTraceRecorder::get().leaveCall(); }
+};
+
+//Put at the top of a public UInventoryComponent call to record it with its arguments when it returns
+struct SIMPLEINVENTORY_API FInventoryTraceScope
+{
+	FInventoryTraceScope(UInventoryComponent* comp, EInventoryTraceOp op, TArrayView<const int32> args = TArrayView<const int32>(), TArrayView<const FInvItem> items = TArrayView<const FInvItem>(), UInventoryComponent* other = nullptr);
+	~FInventoryTraceScope();
+
+private:
+	UInventoryComponent* target = nullptr;
+	bool recording = false;
+	uint64 startCycles = 0;
+	FInventoryTraceCall call;
+};
@@ -0,0 +1,83 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+class UItemAsset;
+
+//What gameplay math needs from a UItemAsset, laid out exactly as it is in the catalog file
+struct FItemCatalogRecord
+{
+	int32 uniqueID = 0;
+	int32 maxStackSize = 0;
+	int32 buyPrice = 0;
+	//Index into the catalog's type names
+	uint16 typeIndex = 0;
+	uint8 footprintX = 1;
+	uint8 footprintY = 1;
+};
+static_assert(sizeof(FItemCatalogRecord) == 16, "Item catalog records are written to disk as is");
+
+//Start of the catalog file, everything after it is found through the counts so the file has no pointers to fix up
+//Layout: header, records sorted by uniqueID, dense index (uint32 record index plus one per ID in [minID, maxID], 0 is none),
+//type name offsets into the UTF-8 name block, then the name block itself
+struct FItemCatalogHeader
+{
+	uint32 magic = 0;
+	uint32 version = 0;
+	uint32 recordCount = 0;
+	uint32 denseCount = 0;
+	int32 minID = 0;
+	int32 maxID = 0;
+	uint32 typeCount = 0;
+	uint32 typeNameBytes = 0;
+};
+static_assert(sizeof(FItemCatalogHeader) == 32, "Item catalog header is written to disk as is");
+
+//Every UItemAsset in the project compiled down to plain records by UItemCatalogCommandlet when a cook starts
+//Loaded once at startup outside the editor and read only after that, so lookups are safe from any thread and never touch UObjects
+class SIMPLEINVENTORY_API FItemCatalog
+{
+public:
+	static constexpr uint32 magic = 0x43544953; //SITC
+	static constexpr uint32 version = 1;
+
+	~FItemCatalog();
+
+	static FItemCatalog& get();
+	//Content/SimpleInventory/ItemCatalog.bin, add the folder to Additional Non-Asset Directories to Package so it gets cooked
+	static FString getDefaultPath();
+
+	//Maps the file if the platform can, otherwise reads it in one go
+	bool load(const FString& path);
+	void reset();
+	bool isLoaded() const { return header != nullptr; }
+
+	//Null if the ID isn't in the catalog
+	const FItemCatalogRecord* find(int32 uniqueID) const;
+
+	//Stack and price math goes through these. They read the catalog record when there is one and fall back to the
+	//asset otherwise, which is always the case in the editor and for items added since the last cook
+	static int32 getMaxStackSize(const UItemAsset* itemAsset);
+	static int32 getBuyPrice(const UItemAsset* itemAsset);
+	FName getTypeName(uint16 typeIndex) const { return typeNames.IsValidIndex(typeIndex) ? typeNames[typeIndex] : NAME_None; }
+	int num() const { return header ? header->recordCount : 0; }
+
+	//Builds the file from records already sorted by uniqueID with no duplicates, used by the commandlet
+	static void write(TArrayView<const FItemCatalogRecord> sortedRecords, TArrayView<const FName> types, TArray<uint8>& outBytes);
+
+private:
+	bool parse(const uint8* data, int64 size);
+
+	TArray<uint8> fileBytes;
+	TUniquePtr<IMappedFileHandle> mappedFile;
+	TUniquePtr<IMappedFileRegion> mappedRegion;
+
+	const FItemCatalogHeader* header = nullptr;
+	const FItemCatalogRecord* records = nullptr;
+	const uint32* denseIndex = nullptr;
+	TArray<FName> typeNames;
+};
@@ -0,0 +1,24 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "ItemCatalogCommandlet.generated.h"
+
+//Compiles every UItemAsset in the project into the FItemCatalog file
+//Cooks run this on their own when they start, or run it by hand with -run=ItemCatalog [-Output=<file>]
+//Fails without writing anything if two items share a uniqueID
+UCLASS()
+class SIMPLEINVENTORY_API UItemCatalogCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UItemCatalogCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+	//Scans, validates and writes the catalog, false if nothing was written
+	static bool buildCatalog(const FString& outputPath);
+};
@@ -0,0 +1,52 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "InventoryItem.h"
+
+//Free list of instance data owned by one inventory, FInvItem only carries the 31 bit handle
+//Handles pack the entry index with a generation so a handle to a freed or reused entry finds nothing,
+//and a tag for the pool above that so a handle from another inventory's pool almost never finds anything.
+//Tags repeat every 255 pools, so anything taking in handles from outside still goes through owns first
+class SIMPLEINVENTORY_API FItemInstancePool
+{
+public:
+	FItemInstancePool();
+
+	int32 allocate(FItemInstanceData&& data);
+	//Safe to call with a stale or empty handle
+	void release(int32 handle);
+	//Moves the data out and frees the entry, false if the handle is stale
+	bool take(int32 handle, FItemInstanceData& outData);
+
+	FItemInstanceData* find(int32 handle);
+	const FItemInstanceData* find(int32 handle) const;
+
+	bool owns(int32 handle) const { return find(handle) != nullptr; }
+	int num() const { return liveCount; }
+	void reset();
+
+private:
+	static constexpr int32 indexBits = 16;
+	static constexpr int32 generationBits = 7;
+	static constexpr int32 indexMask = (1 << indexBits) - 1;
+	static constexpr int32 maxGeneration = (1 << generationBits) - 1;
+	static constexpr int32 tagShift = indexBits + generationBits;
+	static constexpr uint32 maxPoolTag = (1 << (31 - tagShift)) - 1;
+
+	struct FEntry
+	{
+		FItemInstanceData data;
+		int32 generation = 1;
+		int32 nextFree = INDEX_NONE;
+		bool inUse = false;
+	};
+
+	int32 getEntryIndex(int32 handle) const;
+
+	int32 poolTag = 0;
+	TArray<FEntry> entries;
+	int32 freeHead = INDEX_NONE;
+	int liveCount = 0;
+};
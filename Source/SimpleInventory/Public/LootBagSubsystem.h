@@ -0,0 +1,93 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "LootBagSubsystem.generated.h"
+
+class UInventoryComponent;
+
+USTRUCT(BlueprintType, Blueprintable)
+struct FLootBagConsolidationStats
+{
+	GENERATED_USTRUCT_BODY()
+
+public:
+	UPROPERTY(BlueprintReadOnly)
+	int passesCompleted = 0;
+	//Bags emptied into another bag or found empty during the last finished pass
+	UPROPERTY(BlueprintReadOnly)
+	int bagsMergedLastPass = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int64 bagsMergedTotal = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int64 bagsPooledTotal = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int64 bagsDestroyedTotal = 0;
+	//Active bags seen at the start of the last pass
+	UPROPERTY(BlueprintReadOnly)
+	int bagsInWorld = 0;
+	UPROPERTY(BlueprintReadOnly)
+	int bagsInPool = 0;
+};
+
+//Keeps loot bags from piling up over long sessions. Every so often it buckets the active bags into a grid,
+//empties each bag into the fullest ones within the merge distance, looking in the neighbouring cells as well,
+//and returns the emptied bags to a pool that
+//createLootBag pulls from before spawning. The pass is spread over frames so it never costs more than
+//a handful of bags per tick.
+UCLASS()
+class SIMPLEINVENTORY_API ULootBagSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	//Reuses a pooled bag of this class if there is one, otherwise spawns a new one
+	AActor* spawnLootBag(TSubclassOf<AActor> bagClass, const FVector& location, const FRotator& rotation);
+	//Puts an empty bag back in the pool, or destroys it if the pool is full
+	void releaseLootBag(AActor* bag);
+	bool isPooled(const AActor* bag) const;
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Get numbers for the loot bag merge passes"))
+	FLootBagConsolidationStats getStats();
+
+	UFUNCTION(BlueprintCallable, meta = (ToolTip = "Start a merge pass now instead of waiting for the interval"))
+	void requestPass();
+
+private:
+	enum class EPassPhase : uint8
+	{
+		Idle,
+		Bucket,
+		Merge
+	};
+
+	void startPass();
+	void bucketBags(int budget);
+	void mergeCells(int budget);
+	//Returns how many bags were emptied
+	int mergeCell(const FIntVector& cell);
+	static UInventoryComponent* getBagInventory(AActor* bag);
+
+	EPassPhase phase = EPassPhase::Idle;
+	float timeSinceLastPass = 0;
+
+	//Every class createLootBag has spawned, the pass looks for all actors of these
+	TSet<TSubclassOf<AActor>> bagClasses;
+
+	TArray<TWeakObjectPtr<AActor>> passBags;
+	int nextBag = 0;
+	TMap<FIntVector, TArray<TWeakObjectPtr<AActor>>> cells;
+	TArray<FIntVector> cellKeys;
+	int nextCell = 0;
+	int mergedThisPass = 0;
+
+	TArray<TWeakObjectPtr<AActor>> pool;
+
+	FLootBagConsolidationStats stats;
+};
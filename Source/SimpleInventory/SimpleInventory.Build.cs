@@ -35,6 +35,7 @@ public class SimpleInventory : ModuleRules
 			{
 				"CoreUObject",
 				"Engine",
+				"AssetRegistry",
 				"Slate",
 				"SlateCore",
 				// ... add private dependencies that you statically link with here ...	